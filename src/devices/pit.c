@@ -1,5 +1,6 @@
 #include "devices/pit.h"
 #include <debug.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
@@ -11,9 +12,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +79,45 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Programs channel 0 to count down COUNT PIT cycles once and
+   then raise a single interrupt (mode 0, "interrupt on terminal
+   count").  COUNT must be between 1 and 65535.  Periodic
+   operation is restored by calling pit_configure_channel()
+   again. */
+void
+pit_oneshot (unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (count > 0 && count <= UINT16_MAX);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0x30);
+  outb (PIT_PORT_COUNTER (0), count);
+  outb (PIT_PORT_COUNTER (0), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current value of channel 0's down-counter.  If OUT
+   is nonnull, stores the state of the channel's output pin in
+   *OUT; in mode 0 it goes high once the count has expired.  Uses
+   the 8254 read-back command so that count and status are
+   latched at the same instant. */
+unsigned
+pit_read_count (bool *out)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc2);
+  status = inb (PIT_PORT_COUNTER (0));
+  lo = inb (PIT_PORT_COUNTER (0));
+  hi = inb (PIT_PORT_COUNTER (0));
+  intr_set_level (old_level);
+
+  if (out != NULL)
+    *out = (status & 0x80) != 0;
+  return lo | (hi << 8);
+}
@@ -17,10 +17,47 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
+/* Number of timer ticks since OS booted.  A 64-bit value can't
+   be read in one instruction, so readers go through
+   ticks_seqlock instead of turning interrupts off. */
 static int64_t ticks;
-
-static struct list sleep_list;
+static struct seqlock ticks_seqlock;
+
+/* Hierarchical timing wheel of sleeping threads.  Level L has
+   WHEEL_SLOTS slots that each cover WHEEL_SLOTS**L ticks.  A
+   thread due DELTA ticks after wheel_time sits in the lowest
+   level whose span exceeds DELTA; as wheel_time crosses a slot
+   boundary of an upper level, that slot is cascaded down.  A
+   slot in level 0 therefore holds threads due at a single tick,
+   so insertion is O(1) and expiry is O(1) amortized per thread. */
+#define WHEEL_BITS 6                    /* log2 of slots per level. */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)   /* Slots per level. */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4                  /* Covers 2**24 ticks. */
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static struct list wheel_overflow;      /* Sleepers beyond the top level. */
+static int64_t wheel_time;              /* Next tick to be expired. */
+
+/* PIT cycles in one timer tick. */
+#define PIT_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* If false (default), the timer interrupts TIMER_FREQ times per
+   second even when the CPU is idle.
+   If true, the idle thread stops the periodic tick and programs
+   a one-shot interrupt for the next pending wakeup.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* State of the one-shot in flight, if tickless_count != 0. */
+static unsigned tickless_count;         /* PIT cycles programmed. */
+static unsigned tickless_phase;         /* Cycles until its first tick. */
+static int64_t tickless_ticks;          /* Ticks it spans. */
+
+/* True while a one-shot finishes the tick that was in progress
+   when tickless idle ended early, after which the timer
+   interrupt restores the periodic tick. */
+static bool tickless_bridge;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
@@ -31,15 +68,30 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct thread *);
+static void wheel_cascade (void);
+static int64_t apply_slack (int64_t wake_tick, int slack);
+static int64_t wheel_idle_ticks (int64_t limit);
+static void timer_advance (void);
+static void mlfqs_tick (void);
+static void tickless_resume (int64_t cnt, unsigned rest);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  list_init (&wheel_overflow);
+  wheel_time = 0;
+  seqlock_init (&ticks_seqlock);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
-  list_init(&sleep_list);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -73,9 +125,15 @@ timer_calibrate (void)
 int64_t
 timer_ticks (void) 
 {
-  enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
-  intr_set_level (old_level);
+  unsigned seq;
+  int64_t t;
+
+  do
+    {
+      seq = seqlock_read_begin (&ticks_seqlock);
+      t = ticks;
+    }
+  while (seqlock_read_retry (&ticks_seqlock, seq));
   return t;
 }
 
@@ -88,7 +146,8 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.  The wakeup may be deferred by up to the
+   calling thread's timer slack (see timer_set_slack()). */
 void
 timer_sleep (int64_t ticks) 
 {
@@ -98,13 +157,27 @@ timer_sleep (int64_t ticks)
 
   ASSERT (intr_get_level () == INTR_ON);
 
+  if (ticks <= 0)
+    return;
+
   old_level = intr_disable ();
-  t->wake_tick = start + ticks;
-  list_insert_ordered (&sleep_list, &t->elem, tick_less, NULL);
+  t->wake_tick = apply_slack (start + ticks, t->timer_slack);
+  wheel_insert (t);
   thread_block();
   intr_set_level (old_level);
 }
 
+/* Lets timer_sleep() in the running thread oversleep by up to
+   SLACK ticks, so that sleepers with nearby deadlines are woken
+   together in one batch.  A SLACK of 0 (the default) wakes at
+   exactly the requested tick. */
+void
+timer_set_slack (int slack)
+{
+  ASSERT (slack >= 0);
+  thread_current ()->timer_slack = slack;
+}
+
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
 void
@@ -179,8 +252,32 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  enum intr_level old_level;
+  if (tickless_bridge)
+    {
+      tickless_bridge = false;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+
+  timer_advance ();
+  mlfqs_tick ();
+  timer_wake();
+  thread_tick();
+}
+
+/* Counts one timer tick.  Interrupts must be off. */
+static void
+timer_advance (void)
+{
+  seqlock_write_begin (&ticks_seqlock);
   ticks++;
+  seqlock_write_end (&ticks_seqlock);
+}
+
+/* Per-tick bookkeeping of the 4.4BSD scheduler. */
+static void
+mlfqs_tick (void)
+{
+  enum intr_level old_level;
   
   if (thread_mlfqs) {
     old_level = intr_disable();
@@ -188,17 +285,123 @@ timer_interrupt (struct intr_frame *args UNUSED)
  
     if (ticks % TIMER_FREQ == 0) {
       thread_compute_load_avg();
-      thread_compute_recent_cpu_all();
+      thread_decay_recent_cpu();
     }
 
+    /* Only the running thread's recent_cpu moves between
+       decays, so only its priority can have changed. */
     if (ticks % TIME_SLICE == 0) {
-      thread_compute_priority_all();
+      thread_compute_priority(thread_current ());
     }
 
     intr_set_level(old_level);
   }
-  timer_wake();
-  thread_tick();
+}
+
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  In tickless mode, replaces the periodic
+   tick by a single one-shot interrupt at the next tick that has
+   a sleeper due, as far ahead as the PIT's 16-bit counter
+   allows. */
+void
+timer_idle_enter (void)
+{
+  unsigned phase;
+  int64_t idle_ticks;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || tickless_count != 0)
+    return;
+
+  /* PIT cycles left until the periodic tick already in flight. */
+  phase = pit_read_count (NULL);
+  if (phase == 0 || phase > PIT_PER_TICK)
+    return;
+
+  idle_ticks = wheel_idle_ticks (1 + (UINT16_MAX - phase) / PIT_PER_TICK);
+  if (idle_ticks < 2)
+    return;
+
+  /* If a bridging one-shot is in flight, PHASE is what is left
+     of it, and the new one-shot takes its place. */
+  tickless_bridge = false;
+  tickless_phase = phase;
+  tickless_ticks = idle_ticks;
+  tickless_count = phase + (idle_ticks - 1) * PIT_PER_TICK;
+  pit_oneshot (tickless_count);
+}
+
+/* Called on entry to every external interrupt, with interrupts
+   off.  If the CPU was in tickless idle, catches up on the ticks
+   that elapsed during the one-shot and restores the periodic
+   tick, so that a thread woken by the interrupt sees the current
+   time and gets preempted on schedule.  If the interrupt is the
+   one-shot itself, the timer interrupt handler then accounts for
+   its last tick. */
+void
+timer_idle_exit (void)
+{
+  unsigned count, elapsed;
+  bool expired;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (tickless_count == 0)
+    return;
+
+  count = pit_read_count (&expired);
+  if (expired)
+    {
+      /* The one-shot interrupt is pending and will account for
+         the last tick itself once interrupts are re-enabled. */
+      tickless_resume (tickless_ticks - 1, 0);
+    }
+  else
+    {
+      /* Count the whole ticks that elapsed, and keep the next
+         tick on its original schedule. */
+      elapsed = count <= tickless_count ? tickless_count - count : 0;
+      if (elapsed < tickless_phase)
+        tickless_resume (0, tickless_phase - elapsed);
+      else
+        {
+          elapsed -= tickless_phase;
+          tickless_resume (1 + elapsed / PIT_PER_TICK,
+                           PIT_PER_TICK - elapsed % PIT_PER_TICK);
+        }
+    }
+}
+
+/* Credits CNT ticks that passed silently while the CPU was in
+   tickless idle and puts the PIT back into periodic mode.  If
+   REST is nonzero, the next tick is due in REST PIT cycles,
+   which a one-shot covers before the periodic tick resumes, so
+   that the fraction of a tick elapsed at an early wakeup is not
+   lost.  Interrupts must be off. */
+static void
+tickless_resume (int64_t cnt, unsigned rest)
+{
+  int64_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < cnt; i++)
+    {
+      timer_advance ();
+      mlfqs_tick ();
+    }
+  timer_wake ();
+  thread_tick_idle (cnt);
+
+  tickless_count = 0;
+  if (rest > 0 && rest < PIT_PER_TICK)
+    {
+      tickless_bridge = true;
+      pit_oneshot (rest);
+    }
+  else
+    pit_configure_channel (0, 2, TIMER_FREQ);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -272,30 +475,120 @@ real_time_delay (int64_t num, int32_t denom)
   busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
 }
 
+/* Wakes up every sleeping thread whose wake_tick has passed. */
 void 
-timer_wake ()
+timer_wake (void)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  while (wheel_time <= ticks)
+    {
+      struct list *slot;
+
+      if ((wheel_time & WHEEL_MASK) == 0)
+        wheel_cascade ();
+
+      slot = &wheel[0][wheel_time & WHEEL_MASK];
+      while (!list_empty (slot))
+        {
+          struct thread *t = list_entry (list_pop_front (slot),
+                                         struct thread, elem);
+          t->wake_tick = -1;
+          thread_unblock (t);
+        }
+      wheel_time++;
+    }
+  intr_set_level (old_level);
+}
+
+/* Files sleeping thread T into the timing wheel slot for its
+   wake_tick.  Interrupts must be off. */
+static void
+wheel_insert (struct thread *t)
+{
+  int64_t delta = t->wake_tick - wheel_time;
+  struct list *slot;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (delta < 0)
+    slot = &wheel[0][wheel_time & WHEEL_MASK];
+  else
+    {
+      for (level = 0; level < WHEEL_LEVELS; level++)
+        if (delta < (int64_t) 1 << ((level + 1) * WHEEL_BITS))
+          break;
+
+      if (level < WHEEL_LEVELS)
+        slot = &wheel[level][(t->wake_tick >> (level * WHEEL_BITS))
+                             & WHEEL_MASK];
+      else
+        slot = &wheel_overflow;
+    }
+  list_push_back (slot, &t->elem);
+}
+
+/* Moves the threads in the upper-level slots that wheel_time
+   has just reached down to lower levels.  Called whenever
+   wheel_time is a multiple of WHEEL_SLOTS.  Interrupts must be
+   off. */
+static void
+wheel_cascade (void)
 {
-    int64_t current = timer_ticks();
-    enum intr_level old_level;
-    struct thread *target = NULL;
+  struct list pending;
+  int level;
 
-    old_level = intr_disable ();
-    while (!list_empty(&sleep_list) &&
-        current >= list_entry(list_front(&sleep_list), struct thread, elem)->wake_tick)
+  list_init (&pending);
+  for (level = 1; level < WHEEL_LEVELS; level++)
     {
-        target = list_entry(list_pop_front(&sleep_list), struct thread, elem);
-        target->wake_tick = -1;
-        thread_unblock(target);
+      struct list *slot = &wheel[level][(wheel_time >> (level * WHEEL_BITS))
+                                        & WHEEL_MASK];
+      list_splice (list_end (&pending), list_begin (slot), list_end (slot));
+      if (slot != &wheel[level][0])
+        break;
     }
-    intr_set_level (old_level);
+  if (level == WHEEL_LEVELS)
+    list_splice (list_end (&pending), list_begin (&wheel_overflow),
+                 list_end (&wheel_overflow));
+
+  while (!list_empty (&pending))
+    wheel_insert (list_entry (list_pop_front (&pending), struct thread, elem));
+}
+
+/* Returns how many ticks from now, up to LIMIT, until the next
+   tick at which the wheel has work to do: a level-0 slot that
+   is occupied, or a slot boundary at which upper levels might
+   cascade down.  Interrupts must be off. */
+static int64_t
+wheel_idle_ticks (int64_t limit)
+{
+  int64_t t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (t = wheel_time; t < ticks + limit; t++)
+    if ((t & WHEEL_MASK) == 0 || !list_empty (&wheel[0][t & WHEEL_MASK]))
+      break;
+  return t - ticks;
 }
 
-/* Returns true if thread A's wake_tick is less than thread B's wake_tick, false
-   otherwise. */
-bool tick_less(const struct list_elem* a_, const struct list_elem* b_, void* aux UNUSED)
+/* Returns the tick in [WAKE_TICK, WAKE_TICK + SLACK] that is a
+   multiple of the largest power of two, so that threads with
+   nearby deadlines and similar slack land in the same slot. */
+static int64_t
+apply_slack (int64_t wake_tick, int slack)
 {
-    const struct thread* a = list_entry(a_, struct thread, elem);
-    const struct thread* b = list_entry(b_, struct thread, elem);
+  int64_t best = wake_tick;
+  int64_t step;
 
-    return a->wake_tick < b->wake_tick;
+  for (step = 2; step <= slack; step <<= 1)
+    {
+      int64_t rounded = (wake_tick + step - 1) & ~(step - 1);
+      if (rounded > wake_tick + slack)
+        break;
+      best = rounded;
+    }
+  return best;
 }
@@ -20,6 +20,7 @@ void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+void timer_set_slack (int slack);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
@@ -29,7 +30,11 @@ void timer_ndelay (int64_t nanoseconds);
 void timer_print_stats (void);
 
 /* Alarm clock */
-bool tick_less(const struct list_elem* a_, const struct list_elem* b_, void* aux);
 void timer_wake (void);
 
+/* Tickless idle. */
+extern bool timer_tickless;
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,240 @@
+/* Priority queue, implemented as a pairing heap.
+
+   See heap.h for basic information. */
+
+#include "heap.h"
+#include "../debug.h"
+
+static bool before (const struct heap *,
+                    const struct heap_elem *, const struct heap_elem *);
+static struct heap_elem *meld (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+static void detach (struct heap *, struct heap_elem *);
+
+/* Initializes H as an empty heap that compares elements using
+   LESS, given auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux) 
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->elem_cnt = 0;
+  h->next_seq = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Inserts E into H. */
+void
+heap_insert (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  e->seq = h->next_seq++;
+  h->root = meld (h, h->root, e);
+  h->elem_cnt++;
+}
+
+/* Returns the greatest element in H, which must not be empty.
+   Among equal elements, returns the one inserted first. */
+struct heap_elem *
+heap_top (struct heap *h) 
+{
+  ASSERT (!heap_empty (h));
+
+  return h->root;
+}
+
+/* Removes and returns the greatest element in H, which must not
+   be empty. */
+struct heap_elem *
+heap_pop (struct heap *h) 
+{
+  struct heap_elem *top = heap_top (h);
+
+  h->root = merge_pairs (h, top->child);
+  h->elem_cnt--;
+  return top;
+}
+
+/* Removes E, which must be an element of H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e) 
+{
+  detach (h, e);
+  h->elem_cnt--;
+}
+
+/* Restores the ordering of H after the value of its element E
+   has changed.  E keeps its place among elements equal to it. */
+void
+heap_update (struct heap *h, struct heap_elem *e) 
+{
+  detach (h, e);
+  e->child = e->next = e->prev = NULL;
+  h->root = meld (h, h->root, e);
+}
+
+/* Returns the greatest element in H, which must not be empty,
+   as compared by LESS given auxiliary data AUX instead of H's own
+   comparison function.  Among equal elements, returns the one
+   inserted first.  Examines every element, so it takes O(n)
+   time; useful when the values H is ordered by may be out of
+   date.  H is not modified. */
+struct heap_elem *
+heap_max (struct heap *h, heap_less_func *less, void *aux) 
+{
+  struct heap_elem *max, *e;
+
+  ASSERT (!heap_empty (h));
+  ASSERT (less != NULL);
+
+  /* Walk the tree in preorder, going up through the parents of
+     last siblings.  An element's prev is its previous sibling,
+     or its parent if it is a first child. */
+  max = e = h->root;
+  while (e != NULL) 
+    {
+      if (less (max, e, aux) || (!less (e, max, aux) && e->seq < max->seq))
+        max = e;
+
+      if (e->child != NULL)
+        e = e->child;
+      else
+        {
+          while (e != h->root && e->next == NULL)
+            {
+              while (e->prev->child != e)
+                e = e->prev;
+              e = e->prev;
+            }
+          e = e != h->root ? e->next : NULL;
+        }
+    }
+  return max;
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (struct heap *h) 
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+heap_empty (struct heap *h) 
+{
+  return h->root == NULL;
+}
+
+/* Returns true if A should leave H before B. */
+static bool
+before (const struct heap *h,
+        const struct heap_elem *a, const struct heap_elem *b) 
+{
+  if (h->less (b, a, h->aux))
+    return true;
+  else if (h->less (a, b, h->aux))
+    return false;
+  else
+    return (int) (a->seq - b->seq) < 0;
+}
+
+/* Melds the trees rooted at A and B, either of which may be
+   null, and returns the root of the result.  A and B must not
+   have siblings. */
+static struct heap_elem *
+meld (struct heap *h, struct heap_elem *a, struct heap_elem *b) 
+{
+  struct heap_elem *tmp;
+
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+
+  if (before (h, b, a)) 
+    {
+      tmp = a;
+      a = b;
+      b = tmp;
+    }
+
+  /* Make B the leftmost child of A. */
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Melds FIRST and its siblings into a single tree and returns
+   its root, using the standard two-pass scheme: pairs are melded
+   left to right, then the results are melded right to left.
+   Iterative, so that it uses constant stack space. */
+static struct heap_elem *
+merge_pairs (struct heap *h, struct heap_elem *first) 
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  while (first != NULL) 
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+      struct heap_elem *m;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        b->next = b->prev = NULL;
+
+      m = meld (h, a, b);
+      m->next = pairs;
+      pairs = m;
+    }
+
+  while (pairs != NULL) 
+    {
+      struct heap_elem *next = pairs->next;
+
+      pairs->next = NULL;
+      root = meld (h, pairs, root);
+      pairs = next;
+    }
+  return root;
+}
+
+/* Unlinks E from H, leaving its children behind in H. */
+static void
+detach (struct heap *h, struct heap_elem *e) 
+{
+  struct heap_elem *children;
+
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  if (e == h->root) 
+    {
+      h->root = merge_pairs (h, e->child);
+      return;
+    }
+
+  ASSERT (e->prev != NULL);
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+
+  children = merge_pairs (h, e->child);
+  h->root = meld (h, h->root, children);
+}
@@ -0,0 +1,70 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+
+   This is a pairing heap: a multiway tree in which every node
+   is at least as great as its children, kept as a leftmost
+   child and a list of siblings.  Insertion is O(1), and removal
+   of the greatest element, or of an arbitrary element, is
+   O(log n) amortized.
+
+   Like the list and hash table, the heap does not use dynamic
+   allocation.  Each structure that can be in a heap must embed
+   a struct heap_elem member, and heap_entry() converts from the
+   struct heap_elem back to the structure that contains it.
+
+   Elements that compare equal come out in the order in which
+   they were inserted. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem 
+  {
+    struct heap_elem *child;    /* Leftmost child. */
+    struct heap_elem *next;     /* Next sibling. */
+    struct heap_elem *prev;     /* Previous sibling, or parent. */
+    unsigned seq;               /* Insertion order, to break ties. */
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) (HEAP_ELEM)            \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap 
+  {
+    struct heap_elem *root;     /* Greatest element, or null. */
+    size_t elem_cnt;            /* Number of elements in heap. */
+    unsigned next_seq;          /* Sequence number of next insert. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+
+void heap_insert (struct heap *, struct heap_elem *);
+struct heap_elem *heap_top (struct heap *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+struct heap_elem *heap_max (struct heap *, heap_less_func *, void *aux);
+
+size_t heap_size (struct heap *);
+bool heap_empty (struct heap *);
+
+#endif /* lib/kernel/heap.h */
@@ -0,0 +1,60 @@
+/* Tests that releasing a reader-writer lock held for writing lets
+   all of the readers waiting for it in at once, and that a writer
+   then waits for all of them to leave. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define READER_CNT 3
+
+static thread_func reader_thread;
+static struct rwlock rwlock;
+static struct semaphore held, done;
+static int holding;
+
+void
+test_rwlock_batch (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  rwlock_init (&rwlock);
+  sema_init (&held, 0);
+  sema_init (&done, 0);
+
+  rwlock_write_acquire (&rwlock);
+  for (i = 0; i < READER_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT + 1, reader_thread, NULL);
+    }
+
+  msg ("Releasing write lock.");
+  rwlock_write_release (&rwlock);
+  for (i = 0; i < READER_CNT; i++)
+    sema_down (&held);
+  msg ("%d readers hold the lock at once.", holding);
+
+  for (i = 0; i < READER_CNT; i++)
+    sema_up (&done);
+  rwlock_write_acquire (&rwlock);
+  msg ("Writer got the lock with %d readers left.", holding);
+  rwlock_write_release (&rwlock);
+}
+
+static void
+reader_thread (void *aux UNUSED) 
+{
+  rwlock_read_acquire (&rwlock);
+  holding++;
+  sema_up (&held);
+  sema_down (&done);
+  holding--;
+  rwlock_read_release (&rwlock);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOT']);
+(rwlock-batch) begin
+(rwlock-batch) Releasing write lock.
+(rwlock-batch) 3 readers hold the lock at once.
+(rwlock-batch) Writer got the lock with 0 readers left.
+(rwlock-batch) end
+EOT
+pass;
@@ -0,0 +1,49 @@
+/* Tests that a reader-writer lock is handed to its waiters in
+   priority order, readers and writers alike, with readers let in
+   together when no writer of equal or higher priority waits. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread, writer_thread;
+static struct rwlock rwlock;
+
+void
+test_rwlock_priority (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  rwlock_init (&rwlock);
+  rwlock_write_acquire (&rwlock);
+
+  /* Each thread has higher priority than us, so it runs and
+     blocks on RWLOCK right away. */
+  thread_create ("writer 33", PRI_DEFAULT + 2, writer_thread, NULL);
+  thread_create ("reader 32", PRI_DEFAULT + 1, reader_thread, NULL);
+  thread_create ("reader 35", PRI_DEFAULT + 4, reader_thread, NULL);
+  thread_create ("writer 37", PRI_DEFAULT + 6, writer_thread, NULL);
+  thread_create ("reader 34", PRI_DEFAULT + 3, reader_thread, NULL);
+
+  msg ("Releasing write lock.");
+  rwlock_write_release (&rwlock);
+}
+
+static void
+reader_thread (void *aux UNUSED) 
+{
+  rwlock_read_acquire (&rwlock);
+  msg ("Thread %s got the lock.", thread_name ());
+  rwlock_read_release (&rwlock);
+}
+
+static void
+writer_thread (void *aux UNUSED) 
+{
+  rwlock_write_acquire (&rwlock);
+  msg ("Thread %s got the lock.", thread_name ());
+  rwlock_write_release (&rwlock);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOT']);
+(rwlock-priority) begin
+(rwlock-priority) Releasing write lock.
+(rwlock-priority) Thread writer 37 got the lock.
+(rwlock-priority) Thread reader 35 got the lock.
+(rwlock-priority) Thread reader 34 got the lock.
+(rwlock-priority) Thread writer 33 got the lock.
+(rwlock-priority) Thread reader 32 got the lock.
+(rwlock-priority) end
+EOT
+pass;
@@ -0,0 +1,46 @@
+/* Tests that a reader waits for a writer of the same priority
+   that is already waiting for a reader-writer lock, instead of
+   joining the readers that hold it and starving the writer. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread, writer_thread;
+static struct rwlock rwlock;
+
+void
+test_rwlock_writer (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  rwlock_init (&rwlock);
+  rwlock_read_acquire (&rwlock);
+
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread, NULL);
+  thread_create ("reader", PRI_DEFAULT + 1, reader_thread, NULL);
+
+  msg ("Releasing read lock.");
+  rwlock_read_release (&rwlock);
+}
+
+static void
+reader_thread (void *aux UNUSED) 
+{
+  msg ("Reader waiting.");
+  rwlock_read_acquire (&rwlock);
+  msg ("Reader got the lock.");
+  rwlock_read_release (&rwlock);
+}
+
+static void
+writer_thread (void *aux UNUSED) 
+{
+  msg ("Writer waiting.");
+  rwlock_write_acquire (&rwlock);
+  msg ("Writer got the lock.");
+  rwlock_write_release (&rwlock);
+}
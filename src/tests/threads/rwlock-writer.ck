@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOT']);
+(rwlock-writer) begin
+(rwlock-writer) Writer waiting.
+(rwlock-writer) Reader waiting.
+(rwlock-writer) Releasing read lock.
+(rwlock-writer) Writer got the lock.
+(rwlock-writer) Reader got the lock.
+(rwlock-writer) end
+EOT
+pass;
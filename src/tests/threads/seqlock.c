@@ -0,0 +1,38 @@
+/* Tests that a sequence lock makes a reader retry exactly when a
+   write overlapped its read. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+void
+test_seqlock (void) 
+{
+  struct seqlock sl;
+  enum intr_level old_level;
+  unsigned seq;
+
+  seqlock_init (&sl);
+
+  seq = seqlock_read_begin (&sl);
+  msg ("Read with no write %s.",
+       seqlock_read_retry (&sl, seq) ? "retries" : "does not retry");
+
+  seq = seqlock_read_begin (&sl);
+  old_level = intr_disable ();
+  seqlock_write_begin (&sl);
+  seqlock_write_end (&sl);
+  intr_set_level (old_level);
+  msg ("Read across a write %s.",
+       seqlock_read_retry (&sl, seq) ? "retries" : "does not retry");
+
+  old_level = intr_disable ();
+  seqlock_write_begin (&sl);
+  seq = seqlock_read_begin (&sl);
+  msg ("Read during a write %s.",
+       seqlock_read_retry (&sl, seq) ? "retries" : "does not retry");
+  seqlock_write_end (&sl);
+  intr_set_level (old_level);
+}
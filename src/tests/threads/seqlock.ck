@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOT']);
+(seqlock) begin
+(seqlock) Read with no write does not retry.
+(seqlock) Read across a write retries.
+(seqlock) Read during a write retries.
+(seqlock) end
+EOT
+pass;
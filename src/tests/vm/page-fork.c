@@ -0,0 +1,61 @@
+/* Forks a child, which checks that it sees the parent's data
+   segment, bss, and stack as they were at the time of the fork,
+   then overwrites them and exits.  The parent waits for the child
+   and checks that its own copies were not affected. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 4096)
+
+static char data[SIZE] = { 1 };
+static char bss[SIZE];
+
+/* Fails unless all SIZE bytes of BUF are C. */
+static void
+check_fill (const char *buf, size_t size, char c, const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (buf[i] != c)
+      fail ("%s[%zu] is %d, should be %d", name, i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  char stack[4096];
+  pid_t pid;
+
+  memset (data, 'd', sizeof data);
+  memset (bss, 'b', sizeof bss);
+  memset (stack, 's', sizeof stack);
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      check_fill (data, sizeof data, 'd', "data");
+      check_fill (bss, sizeof bss, 'b', "bss");
+      check_fill (stack, sizeof stack, 's', "stack");
+      msg ("child sees parent's memory");
+
+      memset (data, 'D', sizeof data);
+      memset (bss, 'B', sizeof bss);
+      memset (stack, 'S', sizeof stack);
+      check_fill (data, sizeof data, 'D', "data");
+      check_fill (bss, sizeof bss, 'B', "bss");
+      check_fill (stack, sizeof stack, 'S', "stack");
+      msg ("child overwrote its memory");
+      exit (42);
+    }
+
+  msg ("wait(fork()) = %d", wait (pid));
+  check_fill (data, sizeof data, 'd', "data");
+  check_fill (bss, sizeof bss, 'b', "bss");
+  check_fill (stack, sizeof stack, 's', "stack");
+  msg ("parent's memory unchanged");
+}
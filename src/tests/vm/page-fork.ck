@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-fork) begin
+(page-fork) fork
+(page-fork) child sees parent's memory
+(page-fork) child overwrote its memory
+page-fork: exit(42)
+(page-fork) wait(fork()) = 42
+(page-fork) parent's memory unchanged
+(page-fork) end
+page-fork: exit(0)
+EOF
+pass;
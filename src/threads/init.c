@@ -21,6 +21,7 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -37,6 +38,11 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -57,7 +63,16 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* CPUID feature flags (leaf 1, EDX) and control register bits.
+   See [IA32-v2a] "CPUID" and [IA32-v3a] 2.5 "Control
+   Registers". */
+#define CPUID_PSE 0x00000008    /* Page size extensions. */
+#define CPUID_PGE 0x00002000    /* Page global enable. */
+#define CR4_PSE 0x00000010      /* 4 MB pages. */
+#define CR4_PGE 0x00000080      /* Global pages. */
+
 static void bss_init (void);
+static uint32_t cpu_features (void);
 static void paging_init (void);
 
 static char **read_command_line (void);
@@ -98,6 +113,9 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+#ifdef VM
+  frame_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -126,6 +144,10 @@ main (void)
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+  frame_cleaner_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -153,13 +175,21 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports 4 MB pages, each 4 MB region of RAM that
+   lies wholly outside the kernel's read-only text is mapped by a
+   single page directory entry.  The rest of RAM, and all of it
+   on CPUs without PSE, is mapped with 4 kB pages. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpu_features ();
+  bool global = (features & CPUID_PGE) != 0;
+  bool large = (features & CPUID_PSE) != 0;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -171,6 +201,17 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (large && pte_idx == 0
+          && init_ram_pages - page >= PTSPAN / PGSIZE
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_kernel_large (vaddr, true);
+          if (global)
+            pd[pde_idx] |= PTE_G;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -178,6 +219,21 @@ paging_init (void)
         }
 
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+
+      /* Every page directory maps the kernel the same way, so
+         its TLB entries can survive process switches. */
+      if (global)
+        pt[pte_idx] |= PTE_G;
+    }
+
+  /* Large page directory entries are only honored with CR4.PSE
+     set, so turn it on before they become active.  See [IA32-v3a]
+     3.7.3 "Mixing 4-KByte and 4-MByte Pages". */
+  if (large)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
     }
 
   /* Store the physical address of the page directory into CR3
@@ -186,6 +242,26 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Honor PTE_G from now on.  See [IA32-v3a] 3.12
+     "Translation Lookaside Buffers (TLBs)". */
+  if (global)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE));
+    }
+}
+
+/* Returns the CPU's feature flags, from CPUID leaf 1. */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -256,9 +332,17 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-lockprof"))
+        lock_profile = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-fa"))
+        fault_around_max = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -379,8 +463,13 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
+          "  -lockprof          Report lock contention at shutdown.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -fa=COUNT          Map up to COUNT pages ahead of file faults.\n"
 #endif
           );
   shutdown_power_off ();
@@ -359,6 +359,11 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* If this interrupt ends tickless idle, bring the tick
+         count up to date and restore the periodic tick before
+         its handler wakes any thread. */
+      timer_idle_exit ();
     }
 
   /* Invoke the interrupt's handler. */
@@ -29,9 +29,45 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+static heap_less_func waiter_less;
+static heap_less_func waiter_mlfqs_less;
+static heap_less_func semaphore_mlfqs_less;
+static struct heap_elem *waiters_pop (struct heap *, heap_less_func *);
+
+/* If true, collect lock contention statistics. */
+bool lock_profile;
+
+/* Contention statistics for the locks and semaphores initialized
+   at one place in the source.  Semaphores record acquisitions
+   and waits; locks also record how long they were held. */
+struct sync_site
+  {
+    const char *file;           /* Source file of init call. */
+    int line;                   /* Source line of init call. */
+    const char *name;           /* Expression naming the object. */
+    bool is_lock;               /* Initialized by lock_init()? */
+    unsigned long long acquire_cnt;  /* Successful downs. */
+    unsigned long long contend_cnt;  /* Downs that had to wait. */
+    int64_t wait_ticks;         /* Total ticks spent waiting. */
+    int64_t max_wait;           /* Longest single wait. */
+    int64_t hold_ticks;         /* Total ticks locks were held. */
+    int64_t max_hold;           /* Longest single hold. */
+  };
+
+/* Profiled sites.  Sites beyond the first SYNC_SITE_CNT are
+   counted in sync_site_overflow but not profiled. */
+#define SYNC_SITE_CNT 64
+static struct sync_site sync_sites[SYNC_SITE_CNT];
+static size_t sync_site_cnt;
+static unsigned sync_site_overflow;
+
+static struct sync_site *sync_site_lookup (const char *file, int line,
+                                           const char *name, bool is_lock);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -40,14 +76,22 @@
      decrement it.
 
    - up or "V": increment the value (and wake up one waiting
-     thread, if any). */
+     thread, if any).
+
+   FILE, LINE, and NAME identify the caller for the lock
+   profiler; use the sema_init() macro to fill them in.  A null
+   FILE leaves SEMA out of the profile. */
 void
-sema_init (struct semaphore *sema, unsigned value) 
+sema_init_at (struct semaphore *sema, unsigned value,
+              const char *file, int line, const char *name) 
 {
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, waiter_less, NULL);
+  sema->site = (lock_profile && file != NULL
+                ? sync_site_lookup (file, line, name, false)
+                : NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -66,12 +110,33 @@ sema_down (struct semaphore *sema)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  while (sema->value == 0) 
+  if (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
-      thread_block ();
+      int64_t start = timer_ticks ();
+
+      do
+        {
+          struct thread *cur = thread_current ();
+
+          heap_insert (&sema->waiters, &cur->wait_elem);
+          cur->wait_sema = sema;
+          thread_block ();
+        }
+      while (sema->value == 0);
+
+      if (sema->site != NULL)
+        {
+          int64_t wait = timer_elapsed (start);
+
+          sema->site->contend_cnt++;
+          sema->site->wait_ticks += wait;
+          if (wait > sema->site->max_wait)
+            sema->site->max_wait = wait;
+        }
     }
   sema->value--;
+  if (sema->site != NULL)
+    sema->site->acquire_cnt++;
   intr_set_level (old_level);
 }
 
@@ -92,6 +157,8 @@ sema_try_down (struct semaphore *sema)
   if (sema->value > 0) 
     {
       sema->value--;
+      if (sema->site != NULL)
+        sema->site->acquire_cnt++;
       success = true; 
     }
   else
@@ -114,12 +181,15 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   sema->value++;
-  if (!list_empty (&sema->waiters)) {
-    list_sort (&sema->waiters, priority_less, NULL);
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
-    reschedule();
-  }
+  if (!heap_empty (&sema->waiters)) 
+    {
+      struct thread *t = heap_entry (waiters_pop (&sema->waiters,
+                                                  waiter_mlfqs_less),
+                                     struct thread, wait_elem);
+      t->wait_sema = NULL;
+      thread_unblock (t);
+      reschedule ();
+    }
   intr_set_level (old_level);
 }
 
@@ -174,14 +244,21 @@ sema_test_helper (void *sema_)
    another one "up" it, but with a lock the same thread must both
    acquire and release it.  When these restrictions prove
    onerous, it's a good sign that a semaphore should be used,
-   instead of a lock. */
+   instead of a lock.
+
+   FILE, LINE, and NAME identify the caller for the lock
+   profiler; use the lock_init() macro to fill them in. */
 void
-lock_init (struct lock *lock)
+lock_init_at (struct lock *lock, const char *file, int line,
+              const char *name)
 {
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
-  sema_init (&lock->semaphore, 1);
+  lock->hold_start = 0;
+  sema_init_at (&lock->semaphore, 1, file, line, name);
+  if (lock->semaphore.site != NULL)
+    lock->semaphore.site->is_lock = true;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -195,23 +272,28 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
-  struct thread* child = thread_current();
-  
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  if (!thread_mlfqs) {
-      if (lock->holder != NULL) {
-          child->parent = lock->holder;
-          child->acquiring_target_lock = lock;
-          //thread_donate_priority(child, lock);
-      }
-  }
+  old_level = intr_disable ();
+  if (lock->holder != NULL)
+    {
+      cur->waiting_lock = lock;
+      if (!thread_mlfqs)
+        thread_donate_priority (cur);
+    }
 
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
-  //child->acquiring_target_lock = NULL;
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  if (lock->semaphore.site != NULL)
+    lock->hold_start = timer_ticks ();
+  list_push_back (&cur->held_locks, &lock->elem);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -223,14 +305,22 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      if (lock->semaphore.site != NULL)
+        lock->hold_start = timer_ticks ();
+      list_push_back (&lock->holder->held_locks, &lock->elem);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -242,18 +332,44 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
-  struct thread* cur = thread_current ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!thread_mlfqs) {
-      thread_remove_donation(cur, lock);
-      thread_update_priority(cur);
-  }
+  /* Give back what the waiters for LOCK donated to us. */
+  old_level = intr_disable ();
+  if (lock->semaphore.site != NULL)
+    {
+      struct sync_site *site = lock->semaphore.site;
+      int64_t hold = timer_elapsed (lock->hold_start);
 
+      site->hold_ticks += hold;
+      if (hold > site->max_hold)
+        site->max_hold = hold;
+    }
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  if (!thread_mlfqs)
+    thread_update_priority (cur);
+
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+}
+
+/* Returns the highest priority among the threads waiting for
+   LOCK, or PRI_MIN if there are none.  Interrupts must be off. */
+int
+lock_waiter_priority (struct lock *lock)
+{
+  struct heap *waiters = &lock->semaphore.waiters;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (heap_empty (waiters))
+    return PRI_MIN;
+  return heap_entry (heap_top (waiters), struct thread, wait_elem)->priority;
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -267,12 +383,59 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* Orders threads waiting for a semaphore by priority.  A
+   thread's priority may change while it waits, through
+   donation; thread_change_priority() then calls heap_update(). */
+static bool
+waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct thread *a = heap_entry (a_, struct thread, wait_elem);
+  const struct thread *b = heap_entry (b_, struct thread, wait_elem);
+
+  return a->priority < b->priority;
+}
+
+/* Removes and returns the waiter to wake next from WAITERS.
+
+   The 4.4BSD scheduler brings a blocked thread's recent_cpu and
+   priority up to date only when it is unblocked (see
+   thread_compute_recent_cpu()), so under it the order of
+   WAITERS may be stale.  Then the waiters are compared afresh
+   with MLFQS_LESS, at a cost linear in their number. */
+static struct heap_elem *
+waiters_pop (struct heap *waiters, heap_less_func *mlfqs_less) 
+{
+  struct heap_elem *e;
+
+  if (!thread_mlfqs)
+    return heap_pop (waiters);
+
+  e = heap_max (waiters, mlfqs_less, NULL);
+  heap_remove (waiters, e);
+  return e;
+}
+
+/* Like waiter_less(), but compares the priorities that the
+   4.4BSD scheduler would give the waiting threads now. */
+static bool
+waiter_mlfqs_less (const struct heap_elem *a_, const struct heap_elem *b_,
+                   void *aux UNUSED) 
+{
+  struct thread *a = heap_entry (a_, struct thread, wait_elem);
+  struct thread *b = heap_entry (b_, struct thread, wait_elem);
+
+  thread_compute_recent_cpu (a);
+  thread_compute_recent_cpu (b);
+  return thread_mlfqs_priority (a) < thread_mlfqs_priority (b);
+}
+
+/* One semaphore in a heap. */
 struct semaphore_elem 
   {
-    struct list_elem elem;              /* List element. */
+    struct heap_elem elem;              /* Heap element. */
     struct semaphore semaphore;         /* This semaphore. */
-    int priority;
+    struct thread *thread;              /* Waiting thread. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -283,7 +446,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, semaphore_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -309,16 +472,30 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
   struct semaphore_elem waiter;
-  waiter.priority = thread_current()->priority;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
   
-  sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  /* The waiter's semaphore lives only for this call, so leave it
+     unprofiled rather than look up its site on every wait. */
+  sema_init_at (&waiter.semaphore, 0, NULL, 0, NULL);
+  waiter.thread = cur;
+
+  /* Our priority may change while we wait, through donation to
+     other locks we hold, and thread_change_priority() then
+     reorders the waiters.  That happens with interrupts off, so
+     the heap is only touched with interrupts off. */
+  old_level = intr_disable ();
+  heap_insert (&cond->waiters, &waiter.elem);
+  cur->wait_cond = &cond->waiters;
+  cur->wait_cond_elem = &waiter.elem;
+  intr_set_level (old_level);
+
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
@@ -334,17 +511,26 @@ cond_wait (struct condition *cond, struct lock *lock)
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  struct semaphore_elem *waiter = NULL;
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty(&cond->waiters))
-  {
-      list_sort (&cond->waiters, semaphore_less, NULL);
-      sema_up(&list_entry(list_pop_front(&cond->waiters),
-          struct semaphore_elem, elem)->semaphore);
-  }
+  old_level = intr_disable ();
+  if (!heap_empty (&cond->waiters)) 
+    {
+      waiter = heap_entry (waiters_pop (&cond->waiters,
+                                        semaphore_mlfqs_less),
+                           struct semaphore_elem, elem);
+      waiter->thread->wait_cond = NULL;
+    }
+  intr_set_level (old_level);
+
+  if (waiter != NULL)
+    sema_up (&waiter->semaphore);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -359,17 +545,275 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!heap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
 
 
-/* Returns true if semaphore B's priority is less than semaphore A's priority, 
-   false otherwise. */
-bool semaphore_less(const struct list_elem* a_, const struct list_elem* b_, void* aux UNUSED)
+/* Returns true if semaphore A's waiter has lower priority than
+   semaphore B's, false otherwise.  A thread waiting on a
+   condition variable may still hold other locks and receive
+   donations through them; thread_change_priority() then calls
+   heap_update(). */
+bool semaphore_less(const struct heap_elem* a_, const struct heap_elem* b_, void* aux UNUSED)
+{
+    const struct semaphore_elem* a = heap_entry(a_, struct semaphore_elem, elem);
+    const struct semaphore_elem* b = heap_entry(b_, struct semaphore_elem, elem);
+
+    return a->thread->priority < b->thread->priority;
+}
+
+/* Like semaphore_less(), but compares the priorities that the
+   4.4BSD scheduler would give the waiting threads now. */
+static bool
+semaphore_mlfqs_less (const struct heap_elem *a_, const struct heap_elem *b_,
+                      void *aux UNUSED) 
+{
+  struct semaphore_elem *a = heap_entry (a_, struct semaphore_elem, elem);
+  struct semaphore_elem *b = heap_entry (b_, struct semaphore_elem, elem);
+
+  thread_compute_recent_cpu (a->thread);
+  thread_compute_recent_cpu (b->thread);
+  return thread_mlfqs_priority (a->thread) < thread_mlfqs_priority (b->thread);
+}
+
+/* Returns the profile for the lock or semaphore initialized at
+   line LINE of FILE as NAME, creating it if necessary.  Returns
+   a null pointer if the table of sites is full. */
+static struct sync_site *
+sync_site_lookup (const char *file, int line, const char *name,
+                  bool is_lock) 
+{
+  struct sync_site *site = NULL;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < sync_site_cnt; i++)
+    if (sync_sites[i].line == line && !strcmp (sync_sites[i].file, file))
+      {
+        site = &sync_sites[i];
+        break;
+      }
+  if (site == NULL)
+    {
+      if (sync_site_cnt < SYNC_SITE_CNT)
+        {
+          site = &sync_sites[sync_site_cnt++];
+          site->file = file;
+          site->line = line;
+          site->name = name[0] == '&' ? name + 1 : name;
+          site->is_lock = is_lock;
+        }
+      else
+        sync_site_overflow++;
+    }
+  intr_set_level (old_level);
+
+  return site;
+}
+
+/* Prints the contention statistics gathered for each lock and
+   semaphore init site, if profiling is enabled. */
+void
+lock_print_stats (void) 
+{
+  size_t i;
+
+  if (!lock_profile)
+    return;
+
+  for (i = 0; i < sync_site_cnt; i++)
+    {
+      const struct sync_site *site = &sync_sites[i];
+
+      if (site->acquire_cnt == 0)
+        continue;
+      printf ("%s %s (%s:%d): %llu acquires, %llu contended, "
+              "%lld wait ticks (max %lld)",
+              site->is_lock ? "Lock" : "Semaphore", site->name,
+              site->file, site->line, site->acquire_cnt,
+              site->contend_cnt, site->wait_ticks, site->max_wait);
+      if (site->is_lock)
+        printf (", %lld hold ticks (max %lld)",
+                site->hold_ticks, site->max_hold);
+      printf ("\n");
+    }
+  if (sync_site_overflow > 0)
+    printf ("Locks: %u init sites not profiled\n", sync_site_overflow);
+}
+
+/* Returns the priority of the highest-priority thread waiting
+   on COND, or -1 if there are none. */
+static int
+cond_top_priority (struct condition *cond) 
+{
+  if (heap_empty (&cond->waiters))
+    return -1;
+  return heap_entry (heap_top (&cond->waiters),
+                     struct semaphore_elem, elem)->thread->priority;
+}
+
+/* Initializes RW.  A reader-writer lock can be held either by
+   any number of readers at once or by a single writer.
+
+   Waiters are admitted in priority order: a reader does not get
+   in ahead of a waiting writer of equal or higher priority, and a
+   writer waits for the readers holding the lock to drain.  When
+   a writer releases the lock and the highest-priority waiter is
+   a reader, all of the waiting readers are woken as one batch
+   instead of one at a time.
+
+   Like locks, reader-writer locks are not recursive, and they
+   may not be used within an interrupt handler. */
+void
+rwlock_init (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers);
+  cond_init (&rw->writers);
+  rw->reader_cnt = 0;
+  rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it and
+   no writer of our priority or higher is waiting for it, so that
+   a steady stream of readers can't starve writers. */
+void
+rwlock_read_acquire (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL
+         || cond_top_priority (&rw->writers) >= thread_get_priority ())
+    cond_wait (&rw->readers, &rw->lock);
+  rw->reader_cnt++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for reading. */
+void
+rwlock_read_release (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->reader_cnt > 0);
+  if (--rw->reader_cnt == 0)
+    cond_signal (&rw->writers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it. */
+void
+rwlock_write_acquire (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_write_held_by_current_thread (rw));
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->reader_cnt > 0)
+    cond_wait (&rw->writers, &rw->lock);
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for writing,
+   and hands it to the highest-priority waiter: either the next
+   writer, or every waiting reader at once. */
+void
+rwlock_write_release (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_write_held_by_current_thread (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writer = NULL;
+  if (cond_top_priority (&rw->writers) >= cond_top_priority (&rw->readers))
+    cond_signal (&rw->writers, &rw->lock);
+  else
+    cond_broadcast (&rw->readers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool
+rwlock_write_held_by_current_thread (const struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Initializes sequence lock SL.  A sequence lock protects a
+   small, read-mostly value without making readers wait or
+   disable interrupts: a reader copies the value out and then
+   retries if a write happened meanwhile, like this:
+
+        do
+          {
+            seq = seqlock_read_begin (&sl);
+            copy = value;
+          }
+        while (seqlock_read_retry (&sl, seq));
+
+   Writers are not serialized against each other, and a reader
+   that preempted a half-done write would retry forever, so
+   writes must be made with interrupts off, as in an interrupt
+   handler. */
+void
+seqlock_init (struct seqlock *sl) 
+{
+  ASSERT (sl != NULL);
+
+  sl->seq = 0;
+}
+
+/* Starts a read of the value protected by SL and returns a
+   token to pass to seqlock_read_retry(). */
+unsigned
+seqlock_read_begin (const struct seqlock *sl) 
+{
+  unsigned seq = sl->seq;
+  barrier ();
+  return seq;
+}
+
+/* Returns true if the value protected by SL may have changed
+   since the seqlock_read_begin() call that returned START, in
+   which case the read must be repeated. */
+bool
+seqlock_read_retry (const struct seqlock *sl, unsigned start) 
+{
+  barrier ();
+  return (start & 1) != 0 || sl->seq != start;
+}
+
+/* Starts a write of the value protected by SL.  Interrupts must
+   be off. */
+void
+seqlock_write_begin (struct seqlock *sl) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT ((sl->seq & 1) == 0);
+
+  sl->seq++;
+  barrier ();
+}
+
+/* Finishes a write of the value protected by SL. */
+void
+seqlock_write_end (struct seqlock *sl) 
 {
-    const struct semaphore_elem* a = list_entry(a_, struct semaphore_elem, elem);
-    const struct semaphore_elem* b = list_entry(b_, struct semaphore_elem, elem);
+  ASSERT ((sl->seq & 1) != 0);
 
-    return a->priority > b->priority;
+  barrier ();
+  sl->seq++;
 }
@@ -1,46 +1,99 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, by priority. */
+    struct sync_site *site;     /* Profile of init site, or null. */
   };
 
-void sema_init (struct semaphore *, unsigned value);
+void sema_init_at (struct semaphore *, unsigned value,
+                   const char *file, int line, const char *name);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+/* Initializes semaphore SEMA to VALUE, recording the call site
+   for the lock profiler. */
+#define sema_init(SEMA, VALUE) \
+        sema_init_at (SEMA, VALUE, __FILE__, __LINE__, #SEMA)
+
 /* Lock. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's held_locks list. */
+    int64_t hold_start;         /* Tick acquired, for the profiler. */
   };
 
-void lock_init (struct lock *);
+void lock_init_at (struct lock *, const char *file, int line,
+                   const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+int lock_waiter_priority (struct lock *);
+
+/* Initializes LOCK, recording the call site for the lock
+   profiler. */
+#define lock_init(LOCK) lock_init_at (LOCK, __FILE__, __LINE__, #LOCK)
+
+/* If true, collect contention statistics for each site that
+   initializes a lock or semaphore, printed by lock_print_stats().
+   Controlled by kernel command-line option "-lockprof". */
+extern bool lock_profile;
+
+void lock_print_stats (void);
 
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, by priority. */
   };
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
-bool semaphore_less(const struct list_elem* a_, const struct list_elem* b_, void* aux);
+bool semaphore_less(const struct heap_elem* a_, const struct heap_elem* b_, void* aux);
+
+/* Reader-writer lock. */
+struct rwlock 
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers;   /* Waiting readers, by priority. */
+    struct condition writers;   /* Waiting writers, by priority. */
+    unsigned reader_cnt;        /* Number of readers holding lock. */
+    struct thread *writer;      /* Writer holding lock, if any. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_read_acquire (struct rwlock *);
+void rwlock_read_release (struct rwlock *);
+void rwlock_write_acquire (struct rwlock *);
+void rwlock_write_release (struct rwlock *);
+bool rwlock_write_held_by_current_thread (const struct rwlock *);
+
+/* Sequence lock. */
+struct seqlock 
+  {
+    unsigned seq;               /* Odd while a write is in progress. */
+  };
+
+void seqlock_init (struct seqlock *);
+unsigned seqlock_read_begin (const struct seqlock *);
+bool seqlock_read_retry (const struct seqlock *, unsigned start);
+void seqlock_write_begin (struct seqlock *);
+void seqlock_write_end (struct seqlock *);
 
 /* Optimization barrier.
 
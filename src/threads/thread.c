@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -22,9 +23,17 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Longest chain of lock holders that priority donation follows. */
+#define DONATION_DEPTH_MAX 8
+
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO per priority level, and bit N of
+   ready_bitmap is set iff ready_queues[N] is non-empty, so the
+   highest ready priority is a single find-first-set. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint32_t ready_bitmap[(PRI_MAX + 32) / 32];
+static size_t ready_cnt;        /* # of threads in ready_queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -39,6 +48,16 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Pages of exited threads, kept for reuse by thread_create() so
+   that creating a thread does not have to scan the page pool.
+   A cached page begins with the list_elem that links it.  The
+   idle thread zeroes the pages on dirty_pages and moves them to
+   zero_pages.  Both lists are accessed with interrupts off. */
+#define THREAD_PAGE_CACHE_MAX 16
+static struct list dirty_pages;
+static struct list zero_pages;
+static size_t cached_page_cnt;
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame
   {
@@ -52,7 +71,30 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+static long long voluntary_switches;   /* # of switches away from a
+                                          thread that blocked or died. */
+static long long involuntary_switches; /* # of switches away from a
+                                          thread still ready to run. */
+
+/* Scheduler latency, in timer ticks, as log2 histograms per band
+   of LATENCY_BAND_SIZE priorities.  Bucket 0 counts latencies of
+   0 ticks, bucket B > 0 those of 2**(B-1) to 2**B - 1 ticks, and
+   the last bucket everything longer. */
+#define LATENCY_BANDS 4
+#define LATENCY_BAND_SIZE ((PRI_MAX - PRI_MIN + 1) / LATENCY_BANDS)
+#define LATENCY_BUCKETS 16
+static long long ready_latency[LATENCY_BANDS][LATENCY_BUCKETS];
+static long long blocked_latency[LATENCY_BANDS][LATENCY_BUCKETS];
 static int load_avg;
+static struct seqlock load_avg_seqlock;  /* Guards load_avg. */
+
+/* Lazy recent_cpu decay.  decay_epoch counts the per-second
+   decays so far; the coefficient used by decay E is kept in
+   decay_coef[E % DECAY_HISTORY].  Each thread records in its own
+   decay_epoch how far its recent_cpu has been decayed. */
+#define DECAY_HISTORY 64
+static int decay_epoch;
+static int decay_coef[DECAY_HISTORY];
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
@@ -68,9 +110,18 @@ static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
-//static void reschedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
+static struct thread *thread_page_get (void);
+static void thread_page_put (struct thread *);
+static bool thread_page_zero (void);
+static void latency_record (long long hist[][LATENCY_BUCKETS],
+                            const struct thread *, int64_t since);
+static void latency_print (const char *what,
+                           long long hist[][LATENCY_BUCKETS]);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -88,16 +139,21 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
-  //printf("in thread init \n");
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
+  list_init (&dirty_pages);
+  list_init (&zero_pages);
   lock_init (&load_lock);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
+  memset (initial_thread, 0, sizeof *initial_thread);
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
@@ -115,6 +171,7 @@ thread_start (void)
 
   /* Initialize load_avg */
   load_avg = 0;
+  seqlock_init (&load_avg_seqlock);
 
   /* Start preemptive thread scheduling. */
   intr_enable ();
@@ -145,12 +202,24 @@ thread_tick (void)
     intr_yield_on_return ();
 }
 
+/* Credits CNT timer ticks that elapsed while the CPU was in
+   tickless idle (see timer_idle_enter()) to the idle thread. */
+void
+thread_tick_idle (int64_t cnt)
+{
+  idle_ticks += cnt;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld voluntary switches, %lld involuntary switches\n",
+          voluntary_switches, involuntary_switches);
+  latency_print ("ready", ready_latency);
+  latency_print ("blocked", blocked_latency);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -181,7 +250,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_get ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -224,6 +293,7 @@ thread_block (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   thread_current ()->status = THREAD_BLOCKED;
+  thread_current ()->state_tick = timer_ticks ();
   schedule ();
 }
 
@@ -245,10 +315,17 @@ thread_unblock (struct thread *t)
   old_level = intr_disable ();
 
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered (&ready_list, &t->elem, priority_less, NULL);
-  list_sort(&ready_list, priority_less, NULL);
+  if (thread_mlfqs)
+    {
+      /* T's priority was left alone while it was blocked. */
+      thread_compute_recent_cpu (t);
+      thread_compute_priority (t);
+    }
+  if (t->state_tick >= 0)
+    latency_record (blocked_latency, t, t->state_tick);
   t->status = THREAD_READY;
-  //reschedule ();
+  t->state_tick = timer_ticks ();
+  ready_push (t);
 
   intr_set_level (old_level);
 }
@@ -327,9 +404,10 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread)
-    list_insert_ordered (&ready_list, &cur->elem, priority_less, NULL);
   cur->status = THREAD_READY;
+  cur->state_tick = timer_ticks ();
+  if (cur != idle_thread)
+    ready_push (cur);
   schedule ();
   intr_set_level (old_level);
 }
@@ -367,67 +445,56 @@ thread_set_priority (int new_priority)
   struct thread *t = thread_current ();
 
   t->initial_priority = new_priority;
-  t->priority = new_priority;
   thread_update_priority(t);
   reschedule ();
 }
 
+/* Recomputes T's priority as the maximum of its own priority
+   and the priorities of the threads waiting for the locks that T
+   holds. */
 void thread_update_priority (struct thread* t)
 {
-    if (list_empty(&t->donations_list))
-    {
-        t->priority = t->initial_priority;
-    }
-    else
-    {
-        t->priority = list_entry(list_back(&t->donations_list), struct donation_elem, elem)->donated_priority;
-    }
-}
-
-void thread_donate_priority(struct thread* t, struct lock* lock)
-{
+    enum intr_level old_level;
     struct list_elem* e;
-    struct donation_elem* de;
-    struct thread* p = t->parent;
-    struct thread* c = t;
-    struct lock* _lock = lock;
-    int priority = t->priority;
-
-    while (p != NULL)
-    {
-        thread_remove_donation(p, _lock);
+    int priority;
 
-        de = (struct donation_elem*) malloc(sizeof(struct donation_elem));
-        de->donated_priority = priority;
-        de->lock_id = _lock;
-        list_push_back(&p->donations_list, &de->elem);
+    old_level = intr_disable ();
 
-        thread_update_priority(p);
-
-        c = p;
-        p = c->parent;
-        _lock = c->acquiring_target_lock;
+    priority = t->initial_priority;
+    for (e = list_begin(&t->held_locks); e != list_end(&t->held_locks); e = list_next(e))
+    {
+        int donated = lock_waiter_priority(list_entry(e, struct lock, elem));
+        if (donated > priority)
+            priority = donated;
     }
+    thread_change_priority (t, priority);
 
-    reschedule();
+    intr_set_level (old_level);
 }
 
-void thread_remove_donation(struct thread* t, struct lock *lock) {
-    struct list_elem* e;
-    struct donation_elem* s;
+/* Donates DONOR's priority to the holder of the lock that DONOR
+   is waiting for, and on along the chain of holders that are
+   themselves waiting for a lock, at most DONATION_DEPTH_MAX
+   links deep.  Nothing is allocated: each holder's priority is
+   simply raised, and thread_update_priority() recomputes it from
+   the waiters of its locks when it releases one.  Interrupts
+   must be off. */
+void thread_donate_priority(struct thread* donor)
+{
+    struct lock* lock = donor->waiting_lock;
+    int depth;
 
-    if (list_empty(&t->donations_list))
-      return;
+    ASSERT (intr_get_level () == INTR_OFF);
 
-    for (e = list_begin(&t->donations_list); e != list_end(&t->donations_list); e = list_next(e))
+    for (depth = 0; depth < DONATION_DEPTH_MAX && lock != NULL
+                    && lock->holder != NULL; depth++)
     {
-        s = list_entry(e, struct donation_elem, elem);
-        if ( s->lock_id == lock )
-        {
-            list_remove(s);
-            free(s);
+        struct thread* holder = lock->holder;
+
+        if (holder->priority >= donor->priority)
             break;
-        }
+        thread_change_priority (holder, donor->priority);
+        lock = holder->waiting_lock;
     }
 }
 
@@ -467,18 +534,23 @@ thread_get_recent_cpu (void)
 }
 
 /* Returns 100 times the system load average.
-   return value is integer, while stored value is fixed_point */
+   return value is integer, while stored value is fixed_point.
+   load_avg is written only by the timer interrupt, so it is read
+   through load_avg_seqlock without turning interrupts off. */
 int
 thread_get_load_avg (void)
 {
   int result;
-  enum intr_level old_level;
+  unsigned seq;
 
-  old_level = intr_disable ();
-  result = load_avg;
+  do
+    {
+      seq = seqlock_read_begin (&load_avg_seqlock);
+      result = load_avg;
+    }
+  while (seqlock_read_retry (&load_avg_seqlock, seq));
   result = mult_fp_int (result, 100);
   result = fp_to_int_nearest (result);
-  intr_set_level(old_level);
 
   return result;
 }
@@ -493,10 +565,7 @@ thread_set_nice (int nice)
 
   old_level = intr_disable ();
   cur->nice = nice;
-  //thread_compute_recent_cpu (cur);
   thread_compute_priority (cur);
-  if (!list_empty(&ready_list))
-      list_sort(&ready_list, priority_less, NULL);
   intr_set_level(old_level);
   reschedule();
 
@@ -521,46 +590,83 @@ thread_update_recent_cpu ()
   return;
 }
 
+/* Brings T's recent_cpu up to date with the per-second decays
+   that happened since T's decay_epoch.  Running and ready
+   threads are decayed when the second elapses; blocked threads
+   are caught up here when they are next unblocked. */
 void
 thread_compute_recent_cpu(struct thread* t)
 {
     int result;
-    struct list_elem* aelem;
     enum intr_level old_level;
 
     old_level = intr_disable();
 
     if (t != idle_thread)
     {
-        result = mult_fp_int(load_avg, 2);
-        result = div_fp_fp(result, add_fp_int(result, 1));
-        result = mult_fp_fp(result, t->recent_cpu);
-        result = add_fp_int(result, t->nice);
+        result = t->recent_cpu;
+        for (; t->decay_epoch < decay_epoch; t->decay_epoch++)
+        {
+            int prev = result;
+            int epoch = t->decay_epoch;
+            bool forgotten = decay_epoch - epoch > DECAY_HISTORY;
+
+            /* Decays older than we remember reuse the oldest
+               coefficient we have, until the value converges. */
+            if (forgotten)
+                epoch = decay_epoch - DECAY_HISTORY;
+            result = mult_fp_fp(decay_coef[epoch % DECAY_HISTORY], result);
+            result = add_fp_int(result, t->nice);
+            if (forgotten && result == prev)
+                t->decay_epoch = decay_epoch - DECAY_HISTORY - 1;
+        }
         t->recent_cpu = result;
+        t->decay_epoch = decay_epoch;
     }
 
     intr_set_level(old_level);
     return;
 }
 
-/* Compute recent_cpu of all threads */
+/* Starts a new decay epoch of recent_cpu, using the current
+   load_avg.  Called once per second.  Only the running thread and
+   the ready threads, whose priorities decide who runs next, are
+   decayed right away; blocked threads catch up lazily.
+
+   This still costs O(ready threads) with interrupts off once a
+   second.  Decaying raises priorities by amounts that differ from
+   thread to thread, so the run queues can't be kept in order
+   without visiting every ready thread. */
 void
-thread_compute_recent_cpu_all ()
+thread_decay_recent_cpu (void)
 {
   int result;
-  struct thread* t;
-  struct list_elem *aelem;
+  int priority;
+  struct list_elem *e, *next;
   enum intr_level old_level;
 
   old_level = intr_disable ();
 
-  for (aelem = list_begin (&all_list); aelem != list_end (&all_list); aelem = list_next (aelem)) {
-    t = list_entry (aelem, struct thread, allelem);
-    thread_compute_recent_cpu(t);
-  }
+  result = mult_fp_int(load_avg, 2);
+  result = div_fp_fp(result, add_fp_int(result, 1));
+  decay_coef[decay_epoch % DECAY_HISTORY] = result;
+  decay_epoch++;
+
+  thread_compute_recent_cpu (thread_current ());
+  for (priority = PRI_MAX; priority >= PRI_MIN; priority--)
+    for (e = list_begin (&ready_queues[priority]);
+         e != list_end (&ready_queues[priority]); e = next)
+      {
+        /* Recomputing the priority may move T to another queue,
+           possibly one we have yet to visit.  That is harmless,
+           because a thread is decayed at most once per epoch. */
+        struct thread *t = list_entry (e, struct thread, elem);
+        next = list_next (e);
+        thread_compute_recent_cpu (t);
+        thread_compute_priority (t);
+      }
 
   intr_set_level (old_level);
-  return;
 }
 
 /* Compute load_avg */
@@ -568,14 +674,16 @@ void
 thread_compute_load_avg()
 {
   int result;
-  int ready_threads = list_size(&ready_list);
+  int ready_threads = ready_cnt;
   if (thread_current() != idle_thread)
     ready_threads += 1;
 
   result = load_avg;
   result = mult_fp_fp (div_fp_fp (int_to_fp (59), int_to_fp (60)), result);
   ready_threads = mult_fp_int (div_fp_fp (int_to_fp (1), int_to_fp(60)), ready_threads);
+  seqlock_write_begin (&load_avg_seqlock);
   load_avg = add_fp_fp (result, ready_threads);
+  seqlock_write_end (&load_avg_seqlock);
   return;
 }
 
@@ -589,43 +697,31 @@ thread_compute_priority(struct thread* t)
 
     if (t != idle_thread)
     {
-        result = div_fp_int(t->recent_cpu, 4);
-        result = fp_to_int_nearest(result);
-        result = PRI_MAX - result;
-        result = result - t->nice * 2;
-
-        if (result < PRI_MIN) result = PRI_MIN;
-        else if (result > PRI_MAX) result = PRI_MAX;
-        t->priority = result;
+        result = thread_mlfqs_priority (t);
+        thread_change_priority (t, result);
     }
 
     intr_set_level(old_level);
     return;
 }
 
-void
-thread_compute_priority_all(void)
+/* Returns the priority that the 4.4BSD scheduler gives T for its
+   current recent_cpu and nice, without applying it. */
+int
+thread_mlfqs_priority (const struct thread *t)
 {
-  int result;
-  struct thread* t;
-  struct list_elem *aelem;
-  enum intr_level old_level;
-
-  old_level = intr_disable ();
-
-  for (aelem = list_begin (&all_list); aelem != list_end (&all_list); aelem = list_next (aelem)) {
-    t = list_entry (aelem, struct thread, allelem);
-    thread_compute_priority(t);
-  }
+    int result;
 
-  if(!list_empty(&ready_list))
-    list_sort(&ready_list, priority_less, NULL);
+    result = div_fp_int(t->recent_cpu, 4);
+    result = fp_to_int_nearest(result);
+    result = PRI_MAX - result;
+    result = result - t->nice * 2;
 
-  intr_set_level (old_level);
-  return;
+    if (result < PRI_MIN) result = PRI_MIN;
+    else if (result > PRI_MAX) result = PRI_MAX;
+    return result;
 }
 
-
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -648,6 +744,15 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready.  Zero a recycled thread page if
+         there is one, then look again for other work. */
+      if (thread_page_zero ())
+        continue;
+
+      /* Still nothing to do: stop the periodic tick if running
+         tickless. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -707,8 +812,8 @@ init_thread (struct thread *t, const char *name, int priority)
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
+  ASSERT (t->magic == 0);
 
-  memset (t, 0, sizeof *t);
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
@@ -717,14 +822,18 @@ init_thread (struct thread *t, const char *name, int priority)
   t->priority = priority;
   t->initial_priority = priority;
   t->wake_tick = -1;
-  t->parent = NULL;
-  t->acquiring_target_lock = NULL;
-  list_init (&t->donations_list);
+  t->state_tick = -1;
+  t->waiting_lock = NULL;
+  list_init (&t->held_locks);
   t->nice = 0;
   t->recent_cpu = 0;
+  t->decay_epoch = decay_epoch;
 
   t->next_mmap = 0;
-  list_init (&t->mmap_list);
+  list_init (&t->vma_list);
+  t->fault_next = NULL;
+  t->fault_window = 0;
+  t->user_copy = false;
 
 #ifdef USERPROG
   list_init (&t->child_list);
@@ -759,10 +868,86 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  int priority = ready_max_priority ();
+  struct thread *t;
+
+  if (priority < 0)
     return idle_thread;
+
+  t = list_entry (list_front (&ready_queues[priority]), struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Appends READY thread T to the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_bitmap[t->priority / 32] |= 1u << (t->priority % 32);
+  ready_cnt++;
+}
+
+/* Removes T from the run queue it is on.  Interrupts must be
+   off. */
+static void
+ready_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_bitmap[t->priority / 32] &= ~(1u << (t->priority % 32));
+  ready_cnt--;
+}
+
+/* Returns the highest priority that has a ready thread, or -1
+   if the run queue is empty.  Interrupts must be off. */
+static int
+ready_max_priority (void)
+{
+  int word;
+
+  for (word = (PRI_MAX + 32) / 32 - 1; word >= 0; word--)
+    if (ready_bitmap[word] != 0)
+      return word * 32 + 31 - __builtin_clz (ready_bitmap[word]);
+  return -1;
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching run queue if it is ready, or within the waiters of
+   the semaphore it is blocked on, and within the waiters of the
+   condition variable it is waiting on, if any.  Interrupts must
+   be off. */
+void
+thread_change_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (t->priority == priority)
+    return;
+
+  if (t->status == THREAD_READY && t != idle_thread)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else if (t->status == THREAD_BLOCKED && t->wait_sema != NULL)
+    {
+      t->priority = priority;
+      heap_update (&t->wait_sema->waiters, &t->wait_elem);
+    }
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    t->priority = priority;
+
+  if (t->wait_cond != NULL)
+    heap_update (t->wait_cond, t->wait_cond_elem);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -794,6 +979,10 @@ thread_schedule_tail (struct thread *prev)
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Account for the time we spent on the run queue. */
+  if (cur != idle_thread && cur->state_tick >= 0)
+    latency_record (ready_latency, cur, cur->state_tick);
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
@@ -807,7 +996,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      thread_page_put (prev);
     }
 }
 
@@ -830,7 +1019,16 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      if (cur != idle_thread)
+        {
+          if (cur->status == THREAD_READY)
+            involuntary_switches++;
+          else
+            voluntary_switches++;
+        }
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -839,23 +1037,143 @@ schedule (void)
 void
 reschedule (void)
 {
-  if (list_empty(&ready_list))
-    return;
-
   struct thread *cur = thread_current ();
-  struct thread *can = list_entry( list_front(&ready_list), struct thread, elem );
   enum intr_level old_level;
   
   old_level = intr_disable ();
-  if (cur != idle_thread && can->priority > cur->priority)
-  {
-    list_insert_ordered (&ready_list, &cur->elem, priority_less, NULL);
-    cur->status = THREAD_READY;
-    schedule ();
-  }
+  if (cur != idle_thread && ready_max_priority () > cur->priority)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        {
+          cur->status = THREAD_READY;
+          cur->state_tick = timer_ticks ();
+          ready_push (cur);
+          schedule ();
+        }
+    }
+  intr_set_level (old_level);
+}
+
+
+/* Adds the number of ticks since SINCE to the band of HIST for
+   T's priority. */
+static void
+latency_record (long long hist[][LATENCY_BUCKETS], const struct thread *t,
+                int64_t since) 
+{
+  int64_t elapsed = timer_elapsed (since);
+  int bucket = 0;
+
+  while (elapsed > 0 && bucket < LATENCY_BUCKETS - 1)
+    {
+      elapsed >>= 1;
+      bucket++;
+    }
+  hist[(t->priority - PRI_MIN) / LATENCY_BAND_SIZE][bucket]++;
+}
+
+/* Prints the nonempty bands of latency histogram HIST, labeled
+   WHAT. */
+static void
+latency_print (const char *what, long long hist[][LATENCY_BUCKETS]) 
+{
+  int band, bucket, last;
+
+  for (band = 0; band < LATENCY_BANDS; band++)
+    {
+      last = -1;
+      for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        if (hist[band][bucket] != 0)
+          last = bucket;
+      if (last < 0)
+        continue;
+
+      printf ("Thread: %s ticks, priority %d-%d:", what,
+              PRI_MIN + band * LATENCY_BAND_SIZE,
+              PRI_MIN + (band + 1) * LATENCY_BAND_SIZE - 1);
+      for (bucket = 0; bucket <= last; bucket++)
+        if (bucket == 0)
+          printf (" 0:%lld", hist[band][bucket]);
+        else if (bucket == LATENCY_BUCKETS - 1)
+          printf (" %d+:%lld", 1 << (bucket - 1), hist[band][bucket]);
+        else
+          printf (" %d-%d:%lld", 1 << (bucket - 1), (1 << bucket) - 1,
+                  hist[band][bucket]);
+      printf ("\n");
+    }
+}
+
+/* Returns a zeroed page for a new thread, preferably one that
+   the idle thread has already zeroed, or a null pointer if no
+   page is available. */
+static struct thread *
+thread_page_get (void) 
+{
+  struct list_elem *e = NULL;
+  bool zeroed = false;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&zero_pages))
+    {
+      e = list_pop_front (&zero_pages);
+      zeroed = true;
+    }
+  else if (!list_empty (&dirty_pages))
+    e = list_pop_front (&dirty_pages);
+  if (e != NULL)
+    cached_page_cnt--;
   intr_set_level (old_level);
+
+  if (e == NULL)
+    return palloc_get_page (PAL_ZERO);
+  memset (e, 0, zeroed ? sizeof *e : PGSIZE);
+  return (struct thread *) e;
+}
+
+/* Caches the page of dead thread T for reuse, or frees it if the
+   cache is full.  Interrupts must be off. */
+static void
+thread_page_put (struct thread *t) 
+{
+  struct list_elem *e = (struct list_elem *) t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (cached_page_cnt >= THREAD_PAGE_CACHE_MAX)
+    {
+      palloc_free_page (t);
+      return;
+    }
+  list_push_front (&dirty_pages, e);
+  cached_page_cnt++;
 }
 
+/* Zeroes one page on dirty_pages and moves it to zero_pages.
+   Returns false if there was nothing to zero.  Called by the
+   idle thread with interrupts off; interrupts are on while the
+   page is being cleared, so a thread woken meanwhile is not kept
+   waiting. */
+static bool
+thread_page_zero (void) 
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (&dirty_pages))
+    return false;
+  e = list_pop_front (&dirty_pages);
+
+  intr_enable ();
+  memset (e, 0, PGSIZE);
+  intr_disable ();
+
+  list_push_front (&zero_pages, e);
+  return true;
+}
 
 /* Returns a tid to use for a new thread. */
 static tid_t
@@ -90,17 +90,22 @@ struct thread
     int initial_priority;
     int nice;
     int recent_cpu;
+    int decay_epoch;                    /* Last recent_cpu decay applied. */
     int64_t wake_tick;
+    int timer_slack;                    /* Ticks timer_sleep() may oversleep. */
+    int64_t state_tick;                 /* Tick entered READY or BLOCKED. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct heap_elem wait_elem;         /* Semaphore waiters element. */
+    struct semaphore *wait_sema;        /* Semaphore being waited on. */
+    struct heap *wait_cond;             /* Condition waiters we are in. */
+    struct heap_elem *wait_cond_elem;   /* Our element in wait_cond. */
 
     /* project 1 */
-    struct list donations_list;
-
-    struct thread* parent;
-    struct lock* acquiring_target_lock;
+    struct list held_locks;             /* Locks held, for donation. */
+    struct lock* waiting_lock;          /* Lock being waited for. */
 
     /* project 2 */
     /* Owned by userprog/process.c. */
@@ -120,7 +125,11 @@ struct thread
     uint8_t curr_esp;
     
     int next_mmap;
-    struct list mmap_list;
+    struct list vma_list;               /* Areas of address space (vma.c). */
+
+    uint8_t *fault_next;                /* Page just past last fault-around. */
+    int fault_window;                   /* Pages to map around next fault. */
+    bool user_copy;                     /* In copy_from/to_user(). */
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
@@ -131,14 +140,6 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
-struct donation_elem
-{
-    struct list_elem elem;              /* List element. */
-
-    struct lock* lock_id;
-    int donated_priority;
-};
-
 struct child_elem
 {
    struct list_elem elem;
@@ -148,20 +149,13 @@ struct child_elem
    struct semaphore wait_sema;
 };
 
-struct mmap_elem
-{
-   struct list_elem elem;
-
-   int mmap_id;
-   struct list s_pte_list;
-};
-
 struct lock load_lock;
 
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_tick_idle (int64_t cnt);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -185,8 +179,9 @@ void thread_foreach (thread_action_func *, void *);
 int thread_get_priority (void);
 void thread_set_priority (int);
 void thread_update_priority(struct thread* t);
-void thread_donate_priority(struct thread* t, struct lock *lock);
-void thread_remove_donation(struct thread* t, struct lock *lock);
+void thread_change_priority(struct thread* t, int priority);
+void reschedule (void);
+void thread_donate_priority(struct thread* donor);
 
 /* Advanced priority scheduling */
 int thread_get_nice (void);
@@ -195,10 +190,10 @@ int thread_get_load_avg (void);
 void thread_set_nice (int nice);
 void thread_update_recent_cpu(void);
 void thread_compute_recent_cpu(struct thread* t);
-void thread_compute_recent_cpu_all(void);
+void thread_decay_recent_cpu(void);
 void thread_compute_load_avg(void);
 void thread_compute_priority(struct thread* t);
-void thread_compute_priority_all(void);
+int thread_mlfqs_priority (const struct thread *t);
 
 bool priority_less(const struct list_elem* a_, const struct list_elem* b_, void* aux);
 #endif /* threads/thread.h */
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "vm/page.h"
+#include "vm/frame.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -111,6 +112,22 @@ kill (struct intr_frame *f)
     }
 }
 
+/* Ends a page fault that can't be resolved.  A fault in the
+   kernel inside copy_from_user() or copy_to_user() resumes at the
+   address in eax, the copy's recovery code, with -1 in eax.  Any
+   other kills the process. */
+static void
+fault_unresolved (struct intr_frame *f, bool user)
+{
+   if (!user && thread_current ()->user_copy)
+   {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+   }
+   sys_exit(-1, NULL);
+}
+
 /* Page fault handler.  This is a skeleton that must be filled in
    to implement virtual memory.  Some solutions to project 2 may
    also require modifying this code.
@@ -164,7 +181,11 @@ page_fault (struct intr_frame *f)
    //printf("1 with falut_page %#08X and esp %#08X from user %d\n", fault_page, f->esp, user);
 
    if (!not_present) {
-      sys_exit(-1, NULL);
+      /* Writing a page that fork() shares copy-on-write. */
+      pte = write && is_vm_user_vaddr(fault_addr) ? s_page_lookup(fault_page) : NULL;
+      if (pte == NULL || !pte->writable || !frame_unshare(pte))
+         fault_unresolved(f, user);
+      return;
    }
 
    if (is_vm_user_vaddr(fault_addr))
@@ -172,12 +193,12 @@ page_fault (struct intr_frame *f)
       //printf("2\n");
 
       // get page from table
-      pte = s_page_lookup(fault_page);
+      pte = s_page_get(fault_page);
       
       if (pte == NULL)
       {
          //printf("##### pte == NULL!!!\n");
-         if(fault_addr >= PHYS_BASE - 0x0800000 && fault_addr >= (f->esp - 0x100))
+         if(fault_addr >= PHYS_BASE - STACK_MAX && fault_addr >= (f->esp - 0x100))
          {  // grow stack
             //printf("grow stack!\n");
             while(temp_addr < PHYS_BASE) {
@@ -189,31 +210,31 @@ page_fault (struct intr_frame *f)
          }
       } else {
          //printf("before page load\n");
-         error = !s_page_load(pte);
+         if (write || !s_page_map_zero(pte))
+         {
+            error = !s_page_load(pte);
+            if (!error)
+               s_page_fault_around(pte);
+         }
          //printf("after page load\n");
       }
 
       if(pte == NULL) {
          //printf("pte is null after load\n");
-         sys_exit(-1, NULL);
+         fault_unresolved(f, user);
+         return;
       }
    }
    else
    {
-      sys_exit(-1, NULL);
+      fault_unresolved(f, user);
+      return;
    }
 
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
   if (error) 
-  {
-   printf ("Page fault at %p: %s error %s page in %s context.\n",
-          fault_addr,
-          not_present ? "not present" : "rights violation",
-          write ? "writing" : "reading",
-          user ? "user" : "kernel");
-   kill (f);
-  }
+     fault_unresolved(f, user);
 }
 
@@ -14,14 +14,17 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "vm/page.h"
 #include "vm/frame.h"
+#include "vm/vma.h"
 #include "userprog/syscall.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func fork_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 static void argument_passing (char **args, int count, void **esp);
 struct thread_arg
@@ -29,6 +32,11 @@ struct thread_arg
   char *file_name;
   struct thread *parent;
 };
+struct fork_arg
+{
+  struct intr_frame if_;
+  struct thread *parent;
+};
 
 
 /* Starts a new thread running a user program loaded from
@@ -136,9 +144,6 @@ start_process (void *arg)
   child->s_page_table = malloc(sizeof(struct hash));
   s_page_init(child->s_page_table);
 
-  frame_init ();
-  swap_init ();
-
   /* load */
   //printf("before load\n");
   success = load (args[0], &if_.eip, &if_.esp);
@@ -177,6 +182,127 @@ start_process (void *arg)
   NOT_REACHED ();
 }
 
+/* Starts a new thread running a copy of the current process,
+   which returns from the system call with interrupt frame F.
+   Returns the new process's thread id, or TID_ERROR if it cannot
+   be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct thread *cur;
+  struct fork_arg *arg;
+  tid_t tid;
+
+  /* semaphore for copying into child process */
+  cur = thread_current ();
+  cur->load_sema = (struct semaphore *) malloc (sizeof (struct semaphore));
+  if (cur->load_sema == NULL)
+    return TID_ERROR;
+  sema_init (cur->load_sema, 0);
+  cur->is_loaded = 0;
+
+  /* build argument for fork_process */
+  arg = (struct fork_arg *) malloc (sizeof(struct fork_arg));
+  if (arg == NULL)
+  {
+    free (cur->load_sema);
+    return TID_ERROR;
+  }
+  arg->if_ = *f;
+  arg->parent = cur;
+
+  tid = thread_create (cur->name, thread_get_priority (), fork_process, arg);
+  if (tid != TID_ERROR)
+  {
+    sema_down(cur->load_sema);
+  }
+
+  free (arg);
+  free (cur->load_sema);
+  if (cur->is_loaded != 1)
+    return TID_ERROR;
+  return tid;
+}
+
+/* A thread function that copies the parent process, which waits
+   in process_fork() meanwhile, and starts the copy running. */
+static void
+fork_process (void *arg)
+{
+  struct thread *parent, *child;
+  struct child_elem *ce;
+  struct intr_frame if_;
+  bool success = false;
+  int fd;
+
+  /* parse fork_arg */
+  if_ = ((struct fork_arg *)arg)->if_;
+  parent = ((struct fork_arg *)arg)->parent;
+  child = thread_current ();
+
+  /* init page_table */
+  child->s_page_table = malloc(sizeof(struct hash));
+  s_page_init(child->s_page_table);
+
+  /* Allocate and activate page directory. */
+  child->pagedir = pagedir_create ();
+  if (child->pagedir == NULL)
+    goto done;
+  process_activate ();
+
+  /* Open the executable and the parent's files again, at the same
+     positions. */
+  lock_acquire(&syscall_handler_lock);
+  child->run_file = file_reopen (parent->run_file);
+  if (child->run_file != NULL)
+    file_deny_write (child->run_file);
+  for (fd = 3; fd < 131; fd++)
+  {
+    if (parent->file_des[fd] == NULL)
+      continue;
+    child->file_des[fd] = file_reopen (parent->file_des[fd]);
+    if (child->file_des[fd] == NULL)
+      break;
+    file_seek (child->file_des[fd], file_tell (parent->file_des[fd]));
+  }
+  child->next_fd = parent->next_fd;
+  lock_release(&syscall_handler_lock);
+  if (child->run_file == NULL || fd < 131)
+    goto done;
+
+  success = s_page_fork (parent);
+
+ done:
+  if (success)
+  {
+    ce = malloc (sizeof(struct child_elem));
+    if (ce == NULL)
+      success = false;
+  }
+  parent->is_loaded = success;
+
+  if(success)
+  {
+    ce->exit_code = -1;
+    sema_init (&ce->wait_sema, 0);
+    ce->tid = child->tid;
+    child->child_elem = ce;
+    list_push_back (&parent->child_list, &ce->elem);
+
+    sema_up (parent->load_sema);
+  }
+  else /* If copying failed, quit. */
+  {
+    sema_up (parent->load_sema);
+    sys_exit (-1, NULL);
+  }
+
+  /* The child returns 0 from fork(). */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Stack arguemtns
    */
 static void
@@ -295,6 +421,7 @@ process_exit (void)
   {
     free(cur->s_page_table);
   }
+  vma_destroy_all (&cur->vma_list);
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -636,66 +763,20 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   return true;
 }
 
+/* Adds an area to the current process for the segment that
+   load_segment() would load.  Its pages are created and loaded
+   from FILE when they are first faulted in. */
 static bool
 lazy_load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable)
 {
-  //printf("in lazy loading\n");
   ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  struct thread *t;
-  struct s_pte *pte;
-
-  //lock_acquire (&load_lock);
-  t = thread_current ();
-  while (read_bytes > 0 || zero_bytes > 0)
-    {
-     // printf("in while of lazy_loading\n");
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Make a page table entry */
-      pte = (struct s_pte *) malloc (sizeof(struct s_pte));
-      if (pte == NULL)
-      {
-        //lock_release (&load_lock);
-        return false;
-      }
-
-      pte->tid = t->tid;
-      pte->type = s_pte_type_FILE;
-      pte->table_number = upage;
-      
-      pte->writable = writable;
-      pte->file = file;
-      pte->upage = upage;
-      pte->file_page;
-      pte->page_offset = ofs;
-      pte->read_bytes = page_read_bytes;
-      pte->zero_bytes = page_zero_bytes;
-      pte->mmap_id;
-      pte->swap_slot;
-      
-      //printf("table number: %d\n", pte->table_number);
-      /* Add the page table entry */
-      hash_insert (t->s_page_table, &(pte->elem));
-
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      ofs += page_read_bytes;
-      upage += PGSIZE;
-    }
-
-
-  //printf("end of lazy laoding!\n");
-  //lock_release (&load_lock);
-  return true;
+  return vma_create (&thread_current ()->vma_list, upage,
+                     upage + read_bytes + zero_bytes, file, ofs,
+                     read_bytes, writable, s_pte_type_FILE) != NULL;
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
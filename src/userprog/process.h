@@ -2,8 +2,10 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "threads/interrupt.h"
 
 tid_t process_execute (const char *file_name);
+tid_t process_fork (struct intr_frame *f);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -8,6 +8,7 @@
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "vm/page.h"
+#include "vm/vma.h"
 
 bool
 check_mem (void *addr)
@@ -19,56 +20,95 @@ check_mem (void *addr)
 bool
 check_vm_mem (void *addr)
 {
-  return check_mem(addr) && (s_page_lookup (pg_round_down(addr)) != NULL);
+  return check_mem(addr)
+         && (s_page_lookup (pg_round_down(addr)) != NULL
+             || vma_find (&thread_current ()->vma_list, addr) != NULL);
 }
 
+/* Returns true if every page of the SIZE bytes at BUFFER is
+   mapped.  Looks up each page once. */
 bool
 check_buffer (void *buffer, unsigned size)
 {
-  int s;
-  //printf("%#08X\n", buffer);
-  //printf("%#08X\n", pg_round_down(buffer));
-  for (s = 0; s < size; s++) 
+  uint8_t *page, *last;
+
+  if (size == 0)
+    return true;
+
+  last = (uint8_t *) buffer + size - 1;
+  if (last < (uint8_t *) buffer || !check_vm_mem (buffer))
+    return false;
+
+  for (page = pg_round_down (buffer) + PGSIZE; page <= last; page += PGSIZE)
   {
-    if (! check_vm_mem (buffer+s)) {
-      //printf("### s is %d\n", s);
+    if (!check_vm_mem (page))
       return false;
-    }
   }
 
   return true;
 }
 
-/* Reads a byte at user virtual address UADDR.
-   UADDR must be below PHYS_BASE.
-   Returns the byte value if successful, -1 if a segfault occurred.
-   (referenced from official document 3.1.5)
-   */
-int
-load_mem (const uint8_t *addr)
+/* Returns true if the SIZE bytes at UADDR are all in user
+   space. */
+static bool
+check_range (const void *uaddr, size_t size)
+{
+  const uint8_t *last = (const uint8_t *) uaddr + size - 1;
+
+  return size == 0
+         || (check_mem ((void *) uaddr) && last >= (const uint8_t *) uaddr
+             && check_mem ((void *) last));
+}
+
+/* Copies SIZE bytes from SRC to DST a word at a time, where one
+   of them is in user space.  Pages not yet loaded are faulted in
+   as usual.  Returns false if a page fault that page_fault()
+   cannot resolve interrupts the copy: page_fault() then resumes
+   at label 1 with -1 in eax, instead of killing the process
+   (see [IA32-v3a] on the string instructions, and the official
+   document 3.1.5). */
+static bool
+user_copy (void *dst, const void *src, size_t size)
 {
-  if (!check_mem (addr)) return -1;
+  struct thread *t = thread_current ();
+  size_t words = size / sizeof (uint32_t);
+  int fault;
+
+  t->user_copy = true;
+  asm volatile ("movl $1f, %%eax; rep movsl; movl %4, %%ecx; rep movsb;"
+                " xorl %%eax, %%eax; 1:"
+                : "=&a" (fault), "+D" (dst), "+S" (src), "+c" (words)
+                : "g" (size % sizeof (uint32_t))
+                : "memory");
+  t->user_copy = false;
+
+  return fault == 0;
+}
 
-  int result;
-  asm ("movl $1f, %0; movzbl %1, %0; 1:": "=&a" (result) : "m" (*addr));
-  return result;
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Returns false if USRC is not all mapped. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  return check_range (usrc, size) && user_copy (dst, usrc, size);
 }
 
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Returns false if UDST is not all mapped writable. */
+bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  return check_range (udst, size) && user_copy (udst, src, size);
+}
+
+/* Copies SIZE bytes of system call arguments at user address
+   SRC to DST, or kills the process if they are not mapped. */
 void
 read_mem (void *dst, void *src, size_t size)
 {
-  int value;
-  size_t i;
-
-  for (i = 0; i < size; i++)
+  if (!copy_from_user (dst, src, size))
   {
-    value = load_mem (src + i);
-    if(value == -1)
-    {
-      sys_exit(-1, NULL);
-    }
-
-    *(char*)(dst + i) = value & 0xff;
+    sys_exit(-1, NULL);
   }
 
   return;
@@ -228,6 +268,11 @@ syscall_handler (struct intr_frame *f)
       sys_munmap(map_id, f, true);
       break;
     }
+    case SYS_FORK:
+    {
+      sys_fork (f);
+      break;
+    }
   }
 }
 
@@ -278,6 +323,14 @@ sys_exec (void *cmd, struct intr_frame *f)
   return;
 }
 
+void
+sys_fork (struct intr_frame *f)
+{
+  f->eax = process_fork (f);
+
+  return;
+}
+
 void
 sys_wait (int tid, struct intr_frame *f)
 {
@@ -362,6 +415,11 @@ void
 sys_read (int fd, void *buffer, unsigned size, struct intr_frame *f)
 {
   int i;
+
+  /* Fault in and pin the buffer before taking the lock, so that
+     the read neither faults nor has its frames evicted. */
+  if (fd > 2 && !s_page_pin (buffer, size, true))
+    sys_exit(-1, NULL);
   
   if(!lock_held_by_current_thread(&syscall_handler_lock)){
     lock_acquire (&syscall_handler_lock);
@@ -370,19 +428,24 @@ sys_read (int fd, void *buffer, unsigned size, struct intr_frame *f)
   {
     for(i = 0; i < size; i++)
     {
-      ((char *)buffer)[i] = input_getc();
-      if(((char *)buffer)[i] == '\0')
+      char c = input_getc();
+      if (!copy_to_user ((char *)buffer + i, &c, 1))
+      {
+        lock_release (&syscall_handler_lock);
+        sys_exit(-1, NULL);
+      }
+      if(c == '\0')
         break;
     }
     f->eax = i;
   }
   else if(fd > 2) // file
   {
-    if(thread_current()->file_des[fd] == NULL || !check_buffer(buffer, size)){
-      //printf("buffer is not ok %d\n", !check_buffer(buffer, size));
+    if(thread_current()->file_des[fd] == NULL){
       if(lock_held_by_current_thread(&syscall_handler_lock)){
         lock_release (&syscall_handler_lock);
       }
+      s_page_unpin (buffer, size);
       sys_exit(-1, NULL);
     }
 
@@ -393,6 +456,8 @@ sys_read (int fd, void *buffer, unsigned size, struct intr_frame *f)
   if(lock_held_by_current_thread(&syscall_handler_lock)){
     lock_release (&syscall_handler_lock);
   }
+  if (fd > 2)
+    s_page_unpin (buffer, size);
 
   return;
 }
@@ -403,6 +468,11 @@ sys_write (int fd, void *buffer, unsigned size, struct intr_frame *f)
   if (!check_mem (buffer))
     sys_exit (-1, NULL);
 
+  /* Fault in and pin the buffer before taking the lock, so that
+     the write neither faults nor has its frames evicted. */
+  if ((fd == 1 || fd > 2) && !s_page_pin (buffer, size, false))
+    sys_exit (-1, NULL);
+
   if(!lock_held_by_current_thread(&syscall_handler_lock)){
     lock_acquire (&syscall_handler_lock);
   }
@@ -413,10 +483,11 @@ sys_write (int fd, void *buffer, unsigned size, struct intr_frame *f)
   }
   else if (fd > 2)
   {
-    if(thread_current()->file_des[fd] == NULL || !check_buffer(buffer, size)) {
+    if(thread_current()->file_des[fd] == NULL) {
       if(lock_held_by_current_thread(&syscall_handler_lock)){
         lock_release (&syscall_handler_lock);
       }
+      s_page_unpin (buffer, size);
       sys_exit(-1, NULL);
     }
 
@@ -427,6 +498,8 @@ sys_write (int fd, void *buffer, unsigned size, struct intr_frame *f)
   if(lock_held_by_current_thread(&syscall_handler_lock)){
     lock_release (&syscall_handler_lock);
   }
+  if (fd == 1 || fd > 2)
+    s_page_unpin (buffer, size);
 
   return;
 }
@@ -463,16 +536,10 @@ void
 sys_mmap(int fd, void* addr, struct intr_frame *f)
 {
   struct thread *t;
-  struct s_pte* pte;
-  struct mmap_elem *me;
+  struct vma *vma;
   struct file *file;
   uint32_t read_bytes;
-  uint32_t zero_bytes;
-  size_t page_read_bytes;
-  size_t page_zero_bytes;
-  off_t ofs;
-  void* upage;
-  int i_iter, i_end;
+  void *upage, *end;
 
   lock_acquire (&syscall_handler_lock);
 
@@ -501,8 +568,7 @@ sys_mmap(int fd, void* addr, struct intr_frame *f)
   /* get info from the file */
   upage = pg_round_down(addr);
   read_bytes = file_length(t->file_des[fd]); // length of file
-  zero_bytes = PGSIZE - (read_bytes % PGSIZE);
-  ofs = 0;
+  end = upage + ROUND_UP (read_bytes, PGSIZE);
 
   /* file is of length zero */
   if(read_bytes == 0) {
@@ -511,74 +577,31 @@ sys_mmap(int fd, void* addr, struct intr_frame *f)
     return;
   }
 
-
-  /* same address */
-  i_end = read_bytes / PGSIZE;
-  i_end += read_bytes % PGSIZE == 0 ? 0 : 1;
-  for(i_iter = 0; i_iter < i_end; i_iter++) {
-      if(s_page_lookup(upage + i_iter * PGSIZE) != NULL) {
-        f->eax = -1;
-        lock_release(&syscall_handler_lock);
-        return;
-      }
-  } 
-
-  /* create mmap_list_entry for thread */
-  me = (struct mmap_elem *)malloc(sizeof(struct mmap_elem));
-  if (me == NULL) {
+  /* must not wrap around or reach into the stack */
+  if(end < upage || end > PHYS_BASE - STACK_MAX) {
     f->eax = -1;
     lock_release(&syscall_handler_lock);
     return;
   }
-  list_init (&me->s_pte_list);
-  me->mmap_id = t->next_mmap;
 
+  /* create the area; fails if it overlaps code, data or another
+     mapping */
   file = file_reopen(t->file_des[fd]); // reopen file
-
-  /* make s_pte and insert into mmap_list of thread */
-  while (read_bytes > 0 || zero_bytes > 0)
-  {
-    page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    page_zero_bytes = PGSIZE - page_read_bytes;
-
-    /* Make a page table entry */
-    pte = (struct s_pte *) malloc (sizeof(struct s_pte));
-    if (pte == NULL) {
-      f->eax = -1;
-      return;
-    }
-
-    pte->tid = t->tid;
-    pte->type = s_pte_type_MMAP;
-    pte->table_number = upage;
-    pte->writable = true;
-
-    pte->file = file;
-    pte->upage = upage;
-    pte->file_page;
-    pte->page_offset = ofs;
-    pte->read_bytes = page_read_bytes;
-    pte->zero_bytes = page_zero_bytes;
-    pte->mmap_id = me->mmap_id;
-    pte->mmap_elem;
-    pte->swap_slot;
-    
-    /* Add to thread->mmap_list */
-    list_push_back (&(me->s_pte_list), &(pte->mmap_elem));
-
-    /* Add the page table entry */
-    //printf("*** put s_pte mmap_id %d with %#08X\n", pte->mmap_id, pte->upage);
-    hash_insert (t->s_page_table, &(pte->elem));
-    //printf("*** in hash_table s_pte mmap_id %d\n", s_page_lookup(pte->upage)->mmap_id);
-
-    /* Advance. */
-    read_bytes -= page_read_bytes;
-    zero_bytes -= page_zero_bytes;
-    ofs += page_read_bytes;
-    upage += PGSIZE;
+  if (file == NULL) {
+    f->eax = -1;
+    lock_release(&syscall_handler_lock);
+    return;
   }
+  vma = vma_create (&t->vma_list, upage, end, file, 0, read_bytes,
+                    true, s_pte_type_MMAP);
+  if (vma == NULL) {
+    file_close (file);
+    f->eax = -1;
+    lock_release(&syscall_handler_lock);
+    return;
+  }
+  vma->mmap_id = t->next_mmap;
 
-  list_push_back(&t->mmap_list, &(me->elem));
   f->eax = t->next_mmap;
   t->next_mmap++;
 
@@ -593,42 +616,41 @@ sys_munmap(int map_id, struct intr_frame *f, bool from_syscall)
 
   struct thread *t;
   struct list_elem *e;
-  struct mmap_elem *me;
+  struct vma *vma;
   struct s_pte *pte;
-  bool me_found;
+  uint8_t *upage;
+  bool vma_found;
   
   lock_acquire (&syscall_handler_lock);
   t = thread_current ();
 
-  /* find the target mmap_elem in the mmap_list to get list of s_pte's */
-  
-  //printf("iteration on mmap_list start \n");
-  me_found = false;
-  for (e = list_begin (&(t->mmap_list)); e != list_end (&(t->mmap_list));
+  /* find the target area in the vma_list */
+  vma_found = false;
+  for (e = list_begin (&(t->vma_list)); e != list_end (&(t->vma_list));
        e = list_next (e))
     {
-      me = list_entry (e, struct mmap_elem, elem);
+      vma = list_entry (e, struct vma, elem);
 
-      if (me->mmap_id == map_id) {
-        // found mmap_elem
-        me_found = true;
+      if (vma->type == s_pte_type_MMAP && vma->mmap_id == map_id) {
+        // found the area
+        vma_found = true;
         break;
       }
     }
-  //printf("iteration on mmap_list over \n");
 
-  if (!me_found) 
+  if (!vma_found) 
   {
     lock_release(&syscall_handler_lock);
     return;
   }
 
-  /* unmap all of the s_pte in the mmap_list of mmap_elem */
-  //printf("removing s_pte in mmap_list start \n");
-  for (e = list_begin (&me->s_pte_list); e != list_end (&me->s_pte_list); 
-       e = e)
+  /* write back and unmap the pages faulted in so far */
+  for (upage = vma->start; upage < vma->end; upage += PGSIZE)
     {
-      pte = list_entry (e, struct s_pte, mmap_elem);
+      pte = s_page_lookup (upage);
+      if (pte == NULL)
+        continue;
+
       if (pagedir_is_dirty(t->pagedir, pte->upage))
         {
           //printf("dirty pagedir\n");
@@ -636,17 +658,13 @@ sys_munmap(int map_id, struct intr_frame *f, bool from_syscall)
         }
 
       /*  delete from page_table */
-      //printf("removing e\n");
-      e = list_remove (e); // remove s_pte from mmap_list in thread
       s_page_delete (t->s_page_table, &(pte->elem)); // remove s_pte from s_page_table in thread
-      //printf("deletion complete\n");
     }
-  //printf("removing s_pte in mmap_list over \n");
 
-  /* finally remove mmap_list entry from mmap_list in thread */
-  list_remove (&me->elem); 
-  free(me);
+  /* finally remove the area */
+  file_close (vma->file);
+  vma_destroy (vma);
 
   lock_release(&syscall_handler_lock);
   return;
-}
\ No newline at end of file
+}
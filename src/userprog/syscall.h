@@ -28,13 +28,15 @@ void syscall_init (void);
 bool check_mem (void *addr);
 bool check_vm_mem (void *addr);
 bool check_buffer (void *buffer, unsigned size);
-int  load_mem (const uint8_t *addr);
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *src, size_t size);
 void read_mem (void *dst, void *src, size_t size);
 
 static void syscall_handler (struct intr_frame *);
 void sys_halt(void);
 void sys_exit(int , struct intr_frame *);
 void sys_exec(void *, struct intr_frame *);
+void sys_fork(struct intr_frame *);
 void sys_wait(int , struct intr_frame *);
 void sys_create(char *, size_t, struct intr_frame *);
 void sys_remove(char *, struct intr_frame*);
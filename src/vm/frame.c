@@ -1,248 +1,858 @@
 #include "vm/frame.h"
+#include <bitmap.h>
+#include <round.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 
-/* return key */
-unsigned 
-frame_hash (const struct hash_elem *h, void *aux)
+/* Frame table: one entry per user pool frame, allocated from the
+   kernel pool when the page allocator is set up. */
+static struct fte *frame_table;
+static size_t frame_cnt;
+static struct lock frame_lock;
+
+/* Eviction unmaps a frame's pages and marks it evicting, then
+   writes them out without holding frame_lock.  Until it is done,
+   the frame's s_ptes keep pointing to it, and anyone about to
+   read or change their type or swap slot, or free them, waits
+   for frame_evicted. */
+static struct condition frame_evicted;
+
+/* Clock ring of the frames in use, and the clock hand. */
+static struct list frame_list;
+static struct list_elem *celem;
+static size_t frame_used_cnt;   /* Frames on the clock ring. */
+
+/* A page of zeros, from the kernel pool, mapped read-only in
+   place of zero-fill pages until they are first written. */
+static void *zero_frame;
+
+/* Frames holding read-only executable pages, by inode and offset,
+   so that processes running the same program share them. */
+static struct hash text_cache;
+
+/* Free frame watermarks for the page cleaner.  When fewer than
+   frame_low_water frames are free, the cleaner is woken and
+   evicts pages until frame_high_water frames are free, so that
+   most page faults find a free frame without evicting. */
+#define FRAME_LOW_DIVISOR 32
+#define FRAME_HIGH_DIVISOR 16
+static size_t frame_low_water;
+static size_t frame_high_water;
+static struct condition frame_low;  /* Signaled below low water. */
+
+/* Ticks the cleaner sleeps when every frame is pinned or busy.
+   Frames become evictable again through unpins, frees, and the
+   release of syscall_handler_lock, which nothing signals, so the
+   cleaner polls instead of waiting on a condition. */
+#define FRAME_CLEANER_BACKOFF 4
+
+static bool frame_evict_one (bool prefer_clean);
+static size_t frame_free_cnt (void);
+static void frame_cleaner (void *aux UNUSED);
+static struct fte *next_fte (void);
+static void *frame_get (enum palloc_flags flag);
+static void frame_insert (struct fte *f, void *kpage, struct s_pte *pte);
+static void frame_release (struct fte *f);
+static void frame_page_out (struct s_pte *pte, void *kpage, bool dirty);
+static void frame_wait_locked (struct s_pte *pte);
+static bool frame_lock_write_back (struct fte *f, bool *locked);
+static bool frame_is_dirty (struct fte *f);
+static bool frame_swaps_shared (struct fte *f);
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+
+/* Sets up the frame table.  Must be called after palloc_init(),
+   which decides how many frames the user pool has. */
+void 
+frame_init (void)
 {
-    struct fte *ft;
-    
-    ft = hash_entry(h, struct fte, helem);   
+    size_t table_pages, i;
+
+    frame_cnt = palloc_user_page_cnt ();
+    table_pages = DIV_ROUND_UP (frame_cnt * sizeof *frame_table, PGSIZE);
+    frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, table_pages);
+    for (i = 0; i < frame_cnt; i++)
+        list_init (&frame_table[i].rmap);
 
-    return ft->frame_number;
+    lock_init (&frame_lock);
+    cond_init (&frame_evicted);
+    hash_init (&text_cache, text_hash, text_less, NULL);
+    zero_frame = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+    list_init (&frame_list);
+    celem = NULL;
+    frame_used_cnt = 0;
+
+    frame_low_water = frame_cnt / FRAME_LOW_DIVISOR + 1;
+    frame_high_water = frame_cnt / FRAME_HIGH_DIVISOR + 2;
+    cond_init (&frame_low);
 }
 
-bool 
-frame_less (const struct hash_elem *a, const struct hash_elem *b, void *aux)
+/* Starts the page cleaner thread.  Must be called after
+   thread_start() and swap_init(). */
+void
+frame_cleaner_init (void)
 {
-    struct fte *fta, *ftb;
+    thread_create ("frame_cleaner", PRI_DEFAULT, frame_cleaner, NULL);
+}
+
+/* Page cleaner thread.  Sleeps until the number of free frames
+   drops below frame_low_water, then evicts pages until it is
+   back above frame_high_water.  If no frame can be evicted it
+   backs off for a few ticks before trying again, rather than
+   spinning while still below low water. */
+static void
+frame_cleaner (void *aux UNUSED)
+{
+    for (;;)
+    {
+        lock_acquire (&frame_lock);
+        while (frame_free_cnt () >= frame_low_water)
+            cond_wait (&frame_low, &frame_lock);
+        lock_release (&frame_lock);
+
+        while (frame_free_cnt () < frame_high_water)
+            if (!frame_evict_one (false))
+            {
+                timer_sleep (FRAME_CLEANER_BACKOFF);
+                break;
+            }
+    }
+}
 
-    fta = hash_entry(a, struct fte, helem);   
-    ftb = hash_entry(b, struct fte, helem);  
+/* Returns true if enough frames are free that taking one will
+   not lead to eviction, so that it is worth spending frames on
+   pages that have not been asked for yet. */
+bool
+frame_plentiful (void)
+{
+    return frame_free_cnt () >= frame_high_water;
+}
 
-    return fta->frame_number < ftb->frame_number;
+/* Returns the number of user frames not on the clock ring. */
+static size_t
+frame_free_cnt (void)
+{
+    return frame_cnt - frame_used_cnt;
 }
 
-void 
-frame_init ()
+/* Returns the shared page of zeros.  It must never be written,
+   and is not in the frame table, so it is never evicted. */
+void *
+frame_zero (void)
 {
-    if(frame_table != NULL){
-        return;
-    }
-    frame_table = (struct hash *) malloc(sizeof(struct hash));
-    hash_init(frame_table, frame_hash, frame_less, NULL);
-    lock_init (&frame_lock);
+    return zero_frame;
+}
 
-    frame_list = (struct list *)malloc(sizeof(struct list));
-    list_init(frame_list);
-    celem = NULL;
+/* Returns the frame table entry for user pool frame KPAGE, or
+   NULL if KPAGE is not in the user pool. */
+struct fte *
+frame_lookup (void *kpage)
+{
+    size_t idx;
 
-    return;
+    idx = palloc_user_page_idx (pg_round_down (kpage));
+    if (idx == BITMAP_ERROR)
+        return NULL;
+
+    return &frame_table[idx];
+}
+
+/* Allocates a frame for UPAGE, a page of the current process,
+   and returns its kernel address, evicting another page if
+   necessary.  The frame is pinned, so that it is not evicted
+   while the caller fills it; the caller maps UPAGE to the frame
+   and then calls frame_unpin(). */
+void *
+frame_allocate (void *upage, enum palloc_flags flag)
+{
+  void *kpage;
+  struct fte *entry;
+  struct s_pte *pte;
+
+  ASSERT (flag & PAL_USER);
+
+  pte = s_page_lookup (upage);
+  ASSERT (pte != NULL && pte->frame == NULL);
+
+  kpage = frame_get (flag);
+  if (kpage == NULL)
+      return NULL;
+
+  entry = frame_lookup (kpage);
+  lock_acquire (&frame_lock);
+  frame_insert (entry, kpage, pte);
+  lock_release (&frame_lock);
+
+  return kpage;
 }
 
+/* Returns a free user frame, as palloc_get_page(FLAG) would,
+   evicting a page if none is free. */
+static void *
+frame_get (enum palloc_flags flag)
+{
+  void *kpage;
+
+  /* get allocation of kpage.  The cleaner normally keeps frames
+     free; evict here only if it has fallen behind. */
+  kpage = palloc_get_page (flag);
+  if (kpage == NULL) // palloc fail -> eviction
+      kpage = frame_evict (flag); // get allocated again
+
+  return kpage;
+}
+
+/* Puts F, the entry for free frame KPAGE, on the clock ring
+   with PTE as its only mapping.  F starts out pinned once, since
+   it is not mapped yet and so would look unreferenced and clean
+   to the clock.  Must be called with frame_lock held. */
+static void
+frame_insert (struct fte *f, void *kpage, struct s_pte *pte)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f != NULL && list_empty (&f->rmap));
+
+  f->kpage = kpage;
+  f->inode = NULL;
+  f->pin_cnt = 1;
+  f->evicting = false;
+  list_push_back (&f->rmap, &pte->frame_elem);
+  pte->frame = f;
+  list_push_back (&frame_list, &f->lelem);
+  frame_used_cnt++;
+  if (frame_free_cnt () < frame_low_water)
+      cond_signal (&frame_low, &frame_lock);
+}
+
+/* Takes frame KPAGE, freshly allocated by frame_allocate() for a
+   page that could not be loaded, back out of the frame table.
+   Frees the page too if FLAG is true. */
 void
-frame_destroy (struct hash_elem *e, void *aux)
+frame_deallocate (void *kpage, bool flag)
 {
     struct fte *entry;
-    
-    entry = hash_entry(e, struct fte, helem);  
-    lock_acquire(&frame_lock);
-    list_remove (&(entry->lelem));
-    hash_delete(frame_table, &(entry->helem));
-    lock_release(&frame_lock);
-    free(entry);
+
+    entry = frame_lookup (kpage);
+    ASSERT (entry != NULL && list_size (&entry->rmap) == 1);
+
+    lock_acquire (&frame_lock);
+    frame_release (entry);
+    lock_release (&frame_lock);
+
+    /* clear physical frame */
+    if (flag) palloc_free_page (kpage);
 
     return;
 }
 
-void 
-frame_free (struct s_pte *pte, bool flag)
+/* Unmaps PTE's page from its owner and drops it from its frame's
+   reverse mappings.  Frees the frame if no other page maps it. */
+void
+frame_unmap (struct s_pte *pte)
 {
-    struct list_elem *elem;
-    struct fte *target;
+    struct fte *entry;
+    bool last = false;
 
-    for(elem = list_begin(frame_list); elem != list_end(frame_list);
-        elem = list_next (frame_list)) {
-            target = list_entry(elem, struct fte, lelem);
-            if(target->s_pte == pte) {
-                break;
-            }
+    lock_acquire (&frame_lock);
+    frame_wait_locked (pte);
+
+    /* Without a frame, may still map the zero frame. */
+    if (pte->t->pagedir != NULL)
+        pagedir_clear_page (pte->t->pagedir, pte->upage);
+
+    entry = pte->frame;
+    if (entry != NULL)
+    {
+        last = list_size (&entry->rmap) == 1;
+        if (last)
+            frame_release (entry);
+        else
+        {
+            list_remove (&pte->frame_elem);
+            pte->frame = NULL;
+        }
     }
-    if(flag) palloc_free_page (target->frame_number);
-    
-    frame_destroy(&target->helem, NULL);
+    lock_release (&frame_lock);
 
+    if (last)
+        palloc_free_page (entry->kpage);
 }
 
+/* Waits until PTE's page is not being evicted, so that its type
+   and swap slot say where it is. */
+void
+frame_wait (struct s_pte *pte)
+{
+    lock_acquire (&frame_lock);
+    frame_wait_locked (pte);
+    lock_release (&frame_lock);
+}
 
-struct fte*
-frame_lookup(uint8_t *frame_number)
+/* Like frame_wait(), but must be called with frame_lock held. */
+static void
+frame_wait_locked (struct s_pte *pte)
 {
-    //printf("in s_page_lookup\n");
-    struct thread *t;
-    struct fte finder, *entry;
-    struct hash_elem *target;
+    ASSERT (lock_held_by_current_thread (&frame_lock));
 
-    /* find hash table with finder */
-    finder.frame_number = frame_number;
-    target = hash_find(frame_table, &(finder.helem));
-    if(target == NULL)
+    while (pte->frame != NULL && pte->frame->evicting)
+        cond_wait (&frame_evicted, &frame_lock);
+}
+
+/* Takes F off the clock ring and out of the text cache, and
+   detaches every page mapped to it.  F's pages must already be
+   unmapped, or about to be.  Must be called with frame_lock
+   held. */
+static void
+frame_release (struct fte *f)
+{
+    ASSERT (lock_held_by_current_thread (&frame_lock));
+
+    if (celem == &f->lelem)
+        celem = list_prev (celem);
+    list_remove (&f->lelem);
+    if (celem == list_head (&frame_list))
+        celem = NULL;
+    frame_used_cnt--;
+
+    if (f->inode != NULL)
     {
-        return NULL;
+        hash_delete (&text_cache, &f->helem);
+        f->inode = NULL;
     }
 
-    /* find the entry from table */
-    entry = hash_entry (target, struct fte, helem);
-    if(entry == NULL)
+    while (!list_empty (&f->rmap))
     {
-        return NULL;
+        struct s_pte *pte = list_entry (list_pop_front (&f->rmap),
+                                        struct s_pte, frame_elem);
+        pte->frame = NULL;
     }
-    return entry;
 }
 
-/* return kpage */
+/* If another process already has the read-only executable page
+   described by PTE in memory, maps PTE's page to that frame in
+   the current process and returns its kernel address.  Otherwise
+   returns NULL. */
 void *
-frame_allocate(void *upage, enum palloc_flags flag)
+frame_share_text (struct s_pte *pte)
 {
-  void *kpage;
-  struct fte *entry;
-  bool evicted;
+    struct fte key, *entry;
+    struct s_pte *other;
+    struct hash_elem *e;
+    void *kpage = NULL;
+
+    ASSERT (!pte->writable && pte->frame == NULL);
+
+    lock_acquire (&frame_lock);
+    key.inode = file_get_inode (pte->file);
+    key.offset = pte->page_offset;
+    e = hash_find (&text_cache, &key.helem);
+    if (e != NULL)
+    {
+        entry = hash_entry (e, struct fte, helem);
+        other = list_entry (list_front (&entry->rmap), struct s_pte, frame_elem);
+        if (other->read_bytes == pte->read_bytes
+            && pagedir_set_page (pte->t->pagedir, pte->upage, entry->kpage, false))
+        {
+            list_push_back (&entry->rmap, &pte->frame_elem);
+            pte->frame = entry;
+            kpage = entry->kpage;
+        }
+    }
+    lock_release (&frame_lock);
 
-  /* get allocation of kpage */
-  kpage = palloc_get_page (flag);
-  if (kpage == NULL) // palloc fail -> eviction
-  {
-    kpage = frame_evict(flag); // get allocated again
-    //printf("allocate kage %#08X\n", kpage);
-  }
+    return kpage;
+}
 
-  /* make frame table entry */
-  entry = (struct fte *)malloc(sizeof(struct fte));
-  if(entry == NULL) 
-  {
-      printf("entry is NULL\n");
-      return NULL;
-  }
+/* Offers the frame holding PTE's read-only executable page, just
+   loaded from its file, for sharing by other processes. */
+void
+frame_cache_text (struct s_pte *pte)
+{
+    struct fte *entry = pte->frame;
 
-  entry->frame_number = kpage;
-  entry->t = thread_current ();
-  entry->kpage = kpage;
-  entry->upage = upage;
-  entry->s_pte = s_page_lookup(upage);
-  
-  lock_acquire(&frame_lock);
-  /* insert into hash table */
-  hash_insert (frame_table, &(entry->helem));
-  list_push_back (frame_list, &(entry->lelem));
-
-  lock_release(&frame_lock);
-  return kpage;
+    ASSERT (!pte->writable && entry != NULL);
+
+    lock_acquire (&frame_lock);
+    entry->inode = file_get_inode (pte->file);
+    entry->offset = pte->page_offset;
+    if (hash_insert (&text_cache, &entry->helem) != NULL)
+    {
+        /* Someone else loaded the same page first: keep ours
+           private. */
+        entry->inode = NULL;
+    }
+    lock_release (&frame_lock);
 }
 
-void
-frame_deallocate(void *kpage, bool flag)
+/* Called by fork() in the child: if SRC, a page of the parent,
+   is resident, maps DST, the same page of the current process,
+   to its frame.  The caller keeps SRC's frame pinned, so that it
+   is not evicted meanwhile.  A writable page is made read-only
+   in both processes, so that the first write to it gets a copy
+   of its own from frame_unshare().  Returns false if out of
+   memory. */
+bool
+frame_share (struct s_pte *src, struct s_pte *dst)
 {
     struct fte *entry;
+    bool success = true;
 
-    entry = frame_lookup (pg_round_down (kpage));
+    ASSERT (dst->frame == NULL);
 
-    /* clear physical frame */
-    if(flag) palloc_free_page (entry->frame_number);
+    lock_acquire (&frame_lock);
+    entry = src->frame;
+    ASSERT (entry == NULL || !entry->evicting);
+    if (entry != NULL)
+    {
+        success = pagedir_set_page (dst->t->pagedir, dst->upage,
+                                    entry->kpage, false);
+        if (success)
+        {
+            if (src->writable)
+                pagedir_set_writable (src->t->pagedir, src->upage, false);
+
+            /* A page modified in the parent may no longer match
+               its file in the child either. */
+            if (pagedir_is_dirty (src->t->pagedir, src->upage))
+                pagedir_set_dirty (dst->t->pagedir, dst->upage, true);
+
+            list_push_back (&entry->rmap, &dst->frame_elem);
+            dst->frame = entry;
+        }
+    }
+    lock_release (&frame_lock);
 
-    /* destrocy the entry */
-    frame_destroy(&(entry->helem), NULL);
+    return success;
+}
 
-    return;
+/* Handles a write to PTE, a writable page of the current process
+   that frame_share() left mapped read-only.  If another process
+   still shares the frame, copies the page to a new frame;
+   otherwise just makes the mapping writable again.  A page mapped
+   to the zero frame is unmapped, so that the write faults again
+   and loads a frame of its own.  Returns false if out of
+   memory. */
+bool
+frame_unshare (struct s_pte *pte)
+{
+    uint32_t *pd = pte->t->pagedir;
+    struct fte *entry;
+    void *kpage = NULL;
+
+    ASSERT (pte->writable);
+
+    for (;;)
+    {
+        lock_acquire (&frame_lock);
+        frame_wait_locked (pte);
+        entry = pte->frame;
+        if (entry == NULL)
+        {
+            /* Zero-fill, or evicted since the fault: the write
+               will fault again and load the page. */
+            pagedir_clear_page (pd, pte->upage);
+        }
+        else if (list_size (&entry->rmap) == 1)
+            pagedir_set_writable (pd, pte->upage, true);
+        else if (kpage != NULL)
+        {
+            bool dirty = frame_is_dirty (entry);
+
+            memcpy (kpage, entry->kpage, PGSIZE);
+            list_remove (&pte->frame_elem);
+            pte->frame = NULL;
+            frame_insert (frame_lookup (kpage), kpage, pte);
+
+            /* The page table already exists, so this can't
+               fail. */
+            pagedir_clear_page (pd, pte->upage);
+            pagedir_set_page (pd, pte->upage, kpage, true);
+
+            /* The copy doesn't match the file either, or it could
+               be dropped as clean before the write that caused
+               this fault. */
+            if (dirty)
+                pagedir_set_dirty (pd, pte->upage, true);
+            pte->frame->pin_cnt--;
+            kpage = NULL;
+        }
+        else
+        {
+            /* Get a frame to copy into without holding the
+               lock, since that may evict, and try again. */
+            lock_release (&frame_lock);
+            kpage = frame_get (PAL_USER);
+            if (kpage == NULL)
+                return false;
+            continue;
+        }
+        lock_release (&frame_lock);
+        break;
+    }
+
+    if (kpage != NULL)
+        palloc_free_page (kpage);
+    return true;
+}
+
+/* Pins the frame holding PTE's page, a page of the current
+   process, so that it is not evicted until frame_unpin().  If
+   WRITE, the page must also be writable without faulting, so a
+   frame shared with another process can't be pinned.  Returns
+   false if the page has to be faulted in first. */
+bool
+frame_pin (struct s_pte *pte, bool write)
+{
+    uint32_t *pd = pte->t->pagedir;
+    struct fte *entry;
+    bool pinned = false;
+
+    lock_acquire (&frame_lock);
+    frame_wait_locked (pte);
+    entry = pte->frame;
+    if (entry != NULL && (!write || list_size (&entry->rmap) == 1))
+    {
+        if (write)
+            pagedir_set_writable (pd, pte->upage, true);
+        entry->pin_cnt++;
+        pinned = true;
+    }
+    else if (entry == NULL && !write
+             && pagedir_get_page (pd, pte->upage) == zero_frame)
+    {
+        /* The zero frame is never evicted. */
+        pinned = true;
+    }
+    lock_release (&frame_lock);
+
+    return pinned;
+}
+
+/* Releases a pin taken by frame_pin() or frame_allocate(). */
+void
+frame_unpin (struct s_pte *pte)
+{
+    lock_acquire (&frame_lock);
+    if (pte->frame != NULL && pte->frame->pin_cnt > 0)
+        pte->frame->pin_cnt--;
+    lock_release (&frame_lock);
+}
+
+/* Text cache hash function. */
+static unsigned
+text_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct fte *f = hash_entry (e, struct fte, helem);
+
+    return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->offset);
+}
+
+/* Text cache comparison function. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+    const struct fte *a = hash_entry (a_, struct fte, helem);
+    const struct fte *b = hash_entry (b_, struct fte, helem);
+
+    if (a->inode != b->inode)
+        return a->inode < b->inode;
+    return a->offset < b->offset;
 }
 
+/* Evicts a page to make room and returns a newly allocated
+   frame, as palloc_get_page(FLAG) would. */
 void *
-frame_evict(enum palloc_flags flag)
+frame_evict (enum palloc_flags flag)
 {
-  //printf("in frame_evict\n");
   void *kpage;
+
+  do
+  {
+    kpage = palloc_get_page (flag);
+    if (kpage != NULL)
+        return kpage;
+  }
+  while (frame_evict_one (true));
+
+  return NULL;
+}
+
+/* Returns true if any page mapped to frame F has been accessed
+   since the last call, and clears the accessed bits. */
+static bool
+frame_test_and_clear_accessed (struct fte *f)
+{
+    struct list_elem *e;
+    bool accessed = false;
+
+    for (e = list_begin (&f->rmap); e != list_end (&f->rmap); e = list_next (e))
+    {
+        struct s_pte *pte = list_entry (e, struct s_pte, frame_elem);
+
+        if (pagedir_is_accessed (pte->t->pagedir, pte->upage))
+        {
+            pagedir_set_accessed (pte->t->pagedir, pte->upage, false);
+            accessed = true;
+        }
+    }
+    return accessed;
+}
+
+/* Returns true if any page mapped to frame F is dirty. */
+static bool
+frame_is_dirty (struct fte *f)
+{
+    struct list_elem *e;
+
+    for (e = list_begin (&f->rmap); e != list_end (&f->rmap); e = list_next (e))
+    {
+        struct s_pte *pte = list_entry (e, struct s_pte, frame_elem);
+
+        if (pagedir_is_dirty (pte->t->pagedir, pte->upage))
+            return true;
+    }
+    return false;
+}
+
+/* Returns true if the page in frame F can be dropped without
+   any I/O, because an identical copy can be read back from its
+   file. */
+static bool
+frame_is_clean (struct fte *f)
+{
+    struct list_elem *e;
+
+    for (e = list_begin (&f->rmap); e != list_end (&f->rmap); e = list_next (e))
+    {
+        struct s_pte *pte = list_entry (e, struct s_pte, frame_elem);
+
+        if ((pte->type != s_pte_type_FILE && pte->type != s_pte_type_MMAP)
+            || pagedir_is_dirty (pte->t->pagedir, pte->upage))
+            return false;
+    }
+    return true;
+}
+
+/* Returns true if more than one of the pages mapped to frame F
+   would go to swap if it were evicted.  Each of them takes its
+   own swap slot and comes back in its own frame, so evicting a
+   page shared copy-on-write after fork() costs a write per
+   process and loses the sharing. */
+static bool
+frame_swaps_shared (struct fte *f)
+{
+    struct list_elem *e;
+    int swap_cnt = 0;
+
+    for (e = list_begin (&f->rmap); e != list_end (&f->rmap); e = list_next (e))
+    {
+        struct s_pte *pte = list_entry (e, struct s_pte, frame_elem);
+
+        if (pte->type != s_pte_type_MMAP
+            && (pte->type != s_pte_type_FILE
+                || pagedir_is_dirty (pte->t->pagedir, pte->upage))
+            && ++swap_cnt > 1)
+            return true;
+    }
+    return false;
+}
+
+/* Picks a victim with the clock algorithm, unmaps it from every
+   process that maps it, writes it back or out to swap if it has
+   to, and frees its frame.  Returns false if there were no
+   frames to evict.
+
+   For up to two sweeps of the clock it passes over frames that
+   would go to swap once per process sharing them, and evicts
+   them only if nothing else will do.  If PREFER_CLEAN, this is
+   in the way of a page fault, so for those sweeps it also passes
+   over unreferenced pages that need I/O, leaving them for the
+   page cleaner, in search of one that can just be dropped. */
+static bool
+frame_evict_one (bool prefer_clean)
+{
   struct fte *target, *candidate;
   struct s_pte *pte;
-  bool dirty, found;
-  int iterator, access_count;
-  uint32_t swap_id;
+  struct list_elem *e;
+  bool file_locked;
+  size_t clean_tries, shared_tries, pinned_run;
 
   /* get target via clock algorithm */
-  found = false;
-  while(!found)
+  lock_acquire (&frame_lock);
+  clean_tries = prefer_clean ? 2 * frame_used_cnt : 0;
+  shared_tries = 2 * frame_used_cnt;
+  pinned_run = 0;
+  file_locked = false;
+  target = NULL;
+  while (target == NULL)
   {
     candidate = next_fte ();
-    access_count = pagedir_is_accessed(candidate->t->pagedir, candidate->upage);
-    if (access_count != 0)
+    if (candidate == NULL || pinned_run >= frame_used_cnt)
     {
-        pagedir_set_accessed (candidate->t->pagedir, candidate->upage, access_count-1);
+        /* No frames, or all of them pinned or busy. */
+        lock_release (&frame_lock);
+        return false;
+    }
+    if (candidate->pin_cnt > 0)
+    {
+        pinned_run++;
         continue;
     }
-    else
+    if (frame_test_and_clear_accessed (candidate)
+        || (clean_tries > 0 && !frame_is_clean (candidate)))
     {
-        found = true;
-        target = candidate;
+        pinned_run = 0;
+        if (clean_tries > 0)
+            clean_tries--;
+    }
+    else if (shared_tries > 0 && frame_swaps_shared (candidate))
+    {
+        pinned_run = 0;
+        shared_tries--;
     }
+    else if (frame_lock_write_back (candidate, &file_locked))
+        target = candidate;
+    else
+        pinned_run++;
   }
 
-  if (target == NULL)
+  /* Unmap the frame everywhere, and keep anyone from mapping it
+     again while its pages are written out. */
+  target->pin_cnt++;
+  target->evicting = true;
+  if (target->inode != NULL)
+  {
+      hash_delete (&text_cache, &target->helem);
+      target->inode = NULL;
+  }
+  for (e = list_begin (&target->rmap); e != list_end (&target->rmap);
+       e = list_next (e))
   {
-      printf("clock algorithm had wrong target\n");
-      sys_exit(-1, NULL);
+      pte = list_entry (e, struct s_pte, frame_elem);
+      pagedir_clear_page (pte->t->pagedir, pte->upage);
   }
-  
-  pte = target->s_pte;
-  pagedir_clear_page (target->t->pagedir, target->upage);
+  lock_release (&frame_lock);
+
+  /* Nobody changes the reverse mappings of an evicting frame, and
+     the owners of its s_ptes wait for frame_evicted before they
+     touch or free them, so this needs no lock.  The dirty bits
+     stay put now that the pages are unmapped. */
+  for (e = list_begin (&target->rmap); e != list_end (&target->rmap);
+       e = list_next (e))
+  {
+      pte = list_entry (e, struct s_pte, frame_elem);
+      frame_page_out (pte, target->kpage,
+                      pagedir_is_dirty (pte->t->pagedir, pte->upage));
+  }
+  if (file_locked)
+      lock_release (&syscall_handler_lock);
+
+  lock_acquire (&frame_lock);
+  frame_release (target);
+  target->evicting = false;
+  cond_broadcast (&frame_evicted, &frame_lock);
+  lock_release (&frame_lock);
+
+  /* free the frame */
+  palloc_free_page (target->kpage);
+  return true;
+}
+
+/* Returns true if the pages in frame F can be written out now.
+   Writing a dirty memory-mapped page back to its file takes
+   syscall_handler_lock, whose holder may be waiting for this very
+   eviction to finish (see frame_wait()), so the lock is only
+   tried here, and held until the write-back is done; sets
+   *LOCKED if it was taken.  Must be called with frame_lock
+   held. */
+static bool
+frame_lock_write_back (struct fte *f, bool *locked)
+{
+    struct list_elem *e;
+
+    ASSERT (lock_held_by_current_thread (&frame_lock));
 
-  if(pte->file != NULL) {
-    if (pagedir_is_dirty(target->t->pagedir, pte->upage))
+    if (lock_held_by_current_thread (&syscall_handler_lock))
+        return true;
+
+    for (e = list_begin (&f->rmap); e != list_end (&f->rmap); e = list_next (e))
     {
-        //printf("dirty pagedir\n");
-        if(!lock_held_by_current_thread(&syscall_handler_lock))
-            lock_acquire (&syscall_handler_lock);
-        file_write_at (pte->file, pte->upage, pte->read_bytes, pte->page_offset);
-        if(lock_held_by_current_thread(&syscall_handler_lock))
-            lock_release (&syscall_handler_lock);
+        struct s_pte *pte = list_entry (e, struct s_pte, frame_elem);
+
+        if (pte->type == s_pte_type_MMAP
+            && pagedir_is_dirty (pte->t->pagedir, pte->upage))
+        {
+            *locked = lock_try_acquire (&syscall_handler_lock);
+            return *locked;
+        }
     }
-  }
+    return true;
+}
 
-  /* swap out */
-  pte->swap_slot = swap_out(target->kpage);
-  pte->prev_type = pte->type;
-  pte->type = s_pte_type_SWAP;
-  
-  /* remove from frame table */
-  frame_deallocate(target->kpage, true);
-  
-  /* reallocate new page */
-  kpage = palloc_get_page (flag);
-  return kpage;
+/* Saves the contents of KPAGE, which PTE's page was mapped to
+   and which was DIRTY in PTE's owner, wherever PTE will next be
+   loaded from: its file, swap, or nowhere if the file already
+   has it.  A dirty memory-mapped page needs syscall_handler_lock
+   (see frame_lock_write_back()). */
+static void
+frame_page_out (struct s_pte *pte, void *kpage, bool dirty)
+{
+  uint32_t *pd = pte->t->pagedir;
+
+  if (pte->type == s_pte_type_MMAP)
+  {
+    /* Write back if needed, then read it from the file again
+       on the next fault. */
+    if (dirty)
+    {
+        file_write_at (pte->file, kpage, pte->read_bytes, pte->page_offset);
+        pagedir_set_dirty (pd, pte->upage, false);
+    }
+  }
+  else if (pte->type == s_pte_type_FILE && !dirty)
+  {
+    /* Unmodified executable page: read it from the file again on
+       the next fault. */
+  }
+  else
+  {
+    /* swap out */
+    pte->swap_slot = swap_out (kpage);
+    if (pte->swap_slot == BITMAP_ERROR)
+        PANIC ("frame_evict: out of swap slots");
+
+    /* A modified executable page no longer matches its file, so
+       from now on it lives in memory or swap like a stack page. */
+    pte->prev_type = (pte->type == s_pte_type_FILE
+                      ? s_pte_type_STACK : pte->type);
+    pte->type = s_pte_type_SWAP;
+  }
 }
 
-struct fte *
+/* Advances the clock hand and returns the entry it lands on, or
+   NULL if no frames are in use.  Must be called with frame_lock
+   held. */
+static struct fte *
 next_fte (void)
 {
     struct fte *entry;
-    lock_acquire(&frame_lock);
-    if (list_empty (frame_list))
-    {
-        lock_release(&frame_lock);
-        printf("next_clock with empty frame_list\n");
-        sys_exit(-1, NULL);
-    }
 
-    if (celem == NULL || celem == list_back (frame_list) ) 
-    {
-        celem = list_front (frame_list);
-    }
-    else 
-    {
+    ASSERT (lock_held_by_current_thread (&frame_lock));
+    if (list_empty (&frame_list))
+        return NULL;
+
+    if (celem == NULL || celem == list_back (&frame_list))
+        celem = list_front (&frame_list);
+    else
         celem = list_next (celem);
-    }
 
     entry = list_entry (celem, struct fte, lelem);
-    lock_release(&frame_lock);
 
     return entry;
 }
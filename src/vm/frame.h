@@ -2,43 +2,55 @@
 #define VM_FRAME_H
 
 #include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
 #include "vm/page.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 
+/* Frame table entry.  There is one for every frame in the user
+   pool, indexed by the frame's position in the pool. */
 struct fte {
-    struct hash_elem helem;
-    struct list_elem lelem;
-    uint8_t *frame_number; // key
-    
-    void *kpage;
-    void *upage;
-
-    struct thread *t;
-    struct s_pte *s_pte;
+    void *kpage;                /* Kernel address of the frame. */
+
+    /* Reverse mappings: the s_ptes of every page mapped to this
+       frame, linked through their frame_elem.  Empty while the
+       frame is free. */
+    struct list rmap;
+
+    /* Read-only executable pages are shared between processes
+       through the text cache, keyed by file and offset. */
+    struct inode *inode;        /* File of cached page, or NULL. */
+    off_t offset;               /* Offset of the page in the file. */
+    struct hash_elem helem;     /* Text cache element. */
+
+    int pin_cnt;                /* Not evicted while nonzero. */
+    bool evicting;              /* Being written out by eviction. */
+
+    struct list_elem lelem;     /* Clock ring element, while in use. */
 };
 
-/* for global frame_table */
-struct hash *frame_table; 
-struct lock frame_lock;
+void frame_init (void);
+void frame_cleaner_init (void);
 
-/* for clock algorithm */
-struct list *frame_list; 
-struct list_elem *celem;  // clock_elem
+struct fte *frame_lookup (void *kpage);
+void *frame_zero (void);
 
-unsigned frame_hash (const struct hash_elem *h, void *aux);
-bool frame_less (const struct hash_elem *a, const struct hash_elem *b, void *aux);
-void frame_init();
+void *frame_allocate (void *upage, enum palloc_flags flag);
+void frame_deallocate (void *kpage, bool flag);
+void frame_unmap (struct s_pte *pte);
+void frame_wait (struct s_pte *pte);
 
-void frame_destroy (struct hash_elem *e, void *aux);
-void frame_free (struct s_pte *pte, bool flag);
+void *frame_share_text (struct s_pte *pte);
+void frame_cache_text (struct s_pte *pte);
 
-struct fte *frame_lookup(uint8_t *frame_number);
+bool frame_share (struct s_pte *src, struct s_pte *dst);
+bool frame_unshare (struct s_pte *pte);
 
-void *frame_allocate(void *upage, enum palloc_flags flag);
-void frame_deallocate(void *kpage, bool flag);
+bool frame_pin (struct s_pte *pte, bool write);
+void frame_unpin (struct s_pte *pte);
 
-void *frame_evict(enum palloc_flags flag);
-struct fte *next_fte (void);
+bool frame_plentiful (void);
+void *frame_evict (enum palloc_flags flag);
 
-#endif
\ No newline at end of file
+#endif
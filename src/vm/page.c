@@ -1,9 +1,18 @@
 #include "vm/page.h"
+#include <bitmap.h>
 #include "vm/frame.h"
+#include "vm/vma.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 
+static void s_page_release (struct s_pte *entry);
+static void s_page_unpin_range (uint8_t *start, uint8_t *end);
+
+int fault_around_max = 8;
+
 /* return key */
 unsigned 
 s_page_hash (const struct hash_elem *h, void *aux)
@@ -35,6 +44,7 @@ s_page_init(struct hash *target_table)
 void 
 s_page_delete(struct hash *target_table, struct hash_elem *he)
 {
+  s_page_release (hash_entry (he, struct s_pte, elem));
   free(hash_delete (target_table, he));
 }
 
@@ -44,11 +54,104 @@ s_page_destroy (struct hash_elem *e, void *aux)
     struct s_pte *s_pt;
     
     s_pt = hash_entry(e, struct s_pte, elem);  
+    s_page_release (s_pt);
     free(s_pt);
 
     return;
 }
 
+/* Unmaps ENTRY's page from the current process and gives its
+   frame back to the frame table, if it is resident and no other
+   process shares it, or its swap slot back to the swap table, if
+   it is swapped out.  frame_unmap() first waits for an eviction
+   of the page in progress, which may yet swap it out. */
+static void
+s_page_release (struct s_pte *entry)
+{
+    frame_unmap (entry);
+
+    if (entry->type == s_pte_type_SWAP)
+        swap_destroy (entry->swap_slot);
+}
+
+/* Copies the areas and pages of PARENT, which is waiting in
+   fork(), into the current process.  Resident pages are shared
+   with the parent copy-on-write (see frame_share()), swapped out
+   pages get a copy of their swap slot, and pages not yet loaded
+   will be loaded from the executable.  Memory mapped files are
+   not inherited.
+   Returns false if out of memory or swap. */
+bool
+s_page_fork (struct thread *parent)
+{
+    struct thread *t = thread_current ();
+    struct hash_iterator i;
+    struct list_elem *e;
+    struct s_pte *src, *dst;
+    bool pinned, success = true;
+
+    for (e = list_begin (&parent->vma_list); e != list_end (&parent->vma_list);
+         e = list_next (e))
+    {
+        struct vma *vma = list_entry (e, struct vma, elem);
+
+        if (vma->type != s_pte_type_MMAP
+            && vma_create (&t->vma_list, vma->start, vma->end,
+                           vma->file == parent->run_file ? t->run_file : vma->file,
+                           vma->offset, vma->read_bytes, vma->writable,
+                           vma->type) == NULL)
+            return false;
+    }
+
+    hash_first (&i, parent->s_page_table);
+    while (hash_next (&i))
+    {
+        src = hash_entry (hash_cur (&i), struct s_pte, elem);
+        if (src->type == s_pte_type_MMAP)
+            continue;
+
+        dst = (struct s_pte *) malloc (sizeof(struct s_pte));
+        if (dst == NULL)
+            return false;
+
+        /* The parent is waiting for us, but the page cleaner may
+           still evict its pages.  Let an eviction in progress
+           finish and keep the frame from being evicted until it
+           is shared, so that SRC stays as copied. */
+        pinned = frame_pin (src, false);
+        *dst = *src;
+        dst->tid = t->tid;
+        dst->t = t;
+        dst->frame = NULL;
+        if (dst->file == parent->run_file)
+            dst->file = t->run_file;
+
+        if (src->type == s_pte_type_SWAP)
+        {
+            dst->swap_slot = swap_copy (src->swap_slot);
+            if (dst->swap_slot == BITMAP_ERROR)
+            {
+                free (dst);
+                success = false;
+            }
+            else
+                hash_insert (t->s_page_table, &(dst->elem));
+        }
+        else
+        {
+            hash_insert (t->s_page_table, &(dst->elem));
+            success = frame_share (src, dst);
+        }
+
+        if (pinned)
+            frame_unpin (src);
+        if (!success)
+            return false;
+    }
+
+    return true;
+}
+
 void 
 s_page_free(struct hash *target_table)
 {
@@ -58,6 +161,53 @@ s_page_free(struct hash *target_table)
 }
 
 
+/* Returns the s_pte for PAGE in the current process, creating
+   it if PAGE is in one of the process's areas (see vma.c) but
+   has not been faulted in yet.  Returns NULL if PAGE is not
+   mapped or memory allocation fails. */
+struct s_pte *
+s_page_get(void *page)
+{
+    struct thread *t;
+    struct s_pte *pte;
+    struct vma *vma;
+    uint32_t ofs;
+
+    pte = s_page_lookup (page);
+    if (pte != NULL)
+        return pte;
+
+    t = thread_current ();
+    vma = vma_find (&t->vma_list, page);
+    if (vma == NULL)
+        return NULL;
+
+    pte = (struct s_pte *) malloc (sizeof(struct s_pte));
+    if (pte == NULL)
+        return NULL;
+
+    ofs = (uint8_t *) page - vma->start;
+    pte->tid = t->tid;
+    pte->t = t;
+    pte->frame = NULL;
+    pte->type = vma->type;
+    pte->table_number = page;
+
+    pte->writable = vma->writable;
+    pte->file = vma->file;
+    pte->upage = page;
+    pte->page_offset = vma->offset + ofs;
+    pte->read_bytes = ofs < vma->read_bytes ? vma->read_bytes - ofs : 0;
+    if (pte->read_bytes > PGSIZE)
+        pte->read_bytes = PGSIZE;
+    pte->zero_bytes = PGSIZE - pte->read_bytes;
+    pte->mmap_id = vma->mmap_id;
+
+    hash_insert (t->s_page_table, &(pte->elem));
+
+    return pte;
+}
+
 struct s_pte*
 s_page_lookup(void *page)
 {
@@ -92,6 +242,11 @@ s_page_load(struct s_pte *entry)
     //printf("in s_page_load %d\n", entry->tid);
     bool success; 
 
+    /* Evicting the page may be about to change its type. */
+    frame_wait (entry);
+    if (entry->frame != NULL)
+        return true;
+
     /* load page with respect to its type */
     success = false;
     switch (entry->type) 
@@ -126,11 +281,151 @@ s_page_load(struct s_pte *entry)
     return success;
 }
 
+/* Called after a fault on ENTRY's page has been handled.  If
+   the page is file-backed, maps in up to fault_window of the
+   pages that follow it in the same file, as long as they are not
+   present yet and frames are plentiful.  The window doubles, up
+   to fault_around_max, each time a fault lands just past the
+   pages mapped ahead of the previous one, as in a sequential
+   scan, and drops back to 1 otherwise.  Pages that are all
+   zeros, such as bss, get the shared zero frame rather than
+   frames of their own. */
+void
+s_page_fault_around (struct s_pte *entry)
+{
+    struct thread *t = thread_current ();
+    struct s_pte *next;
+    uint8_t *upage;
+    int mapped;
+
+    if (entry->type != s_pte_type_FILE && entry->type != s_pte_type_MMAP)
+        return;
+    if (fault_around_max <= 0)
+        return;
+
+    if (entry->upage == t->fault_next)
+    {
+        t->fault_window *= 2;
+        if (t->fault_window > fault_around_max)
+            t->fault_window = fault_around_max;
+    }
+    else
+        t->fault_window = 1;
+
+    upage = entry->upage;
+    for (mapped = 0; mapped < t->fault_window; mapped++)
+    {
+        upage += PGSIZE;
+        if (!frame_plentiful ())
+            break;
+        next = s_page_get (upage);
+        if (next == NULL || next->type != entry->type
+            || next->file != entry->file
+            || pagedir_get_page (t->pagedir, upage) != NULL
+            || !(s_page_map_zero (next) || s_page_load (next)))
+            break;
+    }
+    t->fault_next = entry->upage + (mapped + 1) * PGSIZE;
+}
+
+/* Faults in every page of the SIZE bytes at user address BUFFER
+   in the current process and pins their frames, so that a system
+   call can access BUFFER without faulting.  If WRITE, the pages
+   are also made writable.  Returns false, with nothing pinned, if
+   some page is not mapped, or not writable when WRITE, or can't be
+   loaded.  Undo with s_page_unpin(). */
+bool
+s_page_pin (void *buffer, size_t size, bool write)
+{
+    uint8_t *page, *last;
+    struct s_pte *pte;
+
+    if (size == 0)
+        return true;
+
+    last = (uint8_t *) buffer + size - 1;
+    if (buffer == NULL || last < (uint8_t *) buffer
+        || !is_vm_user_vaddr (buffer) || !is_vm_user_vaddr (last))
+        return false;
+
+    for (page = pg_round_down (buffer); page <= last; page += PGSIZE)
+    {
+        pte = s_page_get (page);
+        if (pte == NULL || (write && !pte->writable))
+            goto fail;
+
+        /* Fault the page in as an access would, until it stays
+           in long enough to be pinned. */
+        while (!frame_pin (pte, write))
+        {
+            if (write && !frame_unshare (pte))
+                goto fail;
+            if (pte->frame == NULL && !s_page_load (pte))
+                goto fail;
+        }
+    }
+    return true;
+
+ fail:
+    s_page_unpin_range (pg_round_down (buffer), page);
+    return false;
+}
+
+/* Unpins the pages of the SIZE bytes at BUFFER, which
+   s_page_pin() pinned. */
+void
+s_page_unpin (void *buffer, size_t size)
+{
+    if (size == 0)
+        return;
+
+    s_page_unpin_range (pg_round_down (buffer),
+                        (uint8_t *) buffer + size);
+}
+
+/* Unpins the pages from START up to END. */
+static void
+s_page_unpin_range (uint8_t *start, uint8_t *end)
+{
+    uint8_t *page;
+    struct s_pte *pte;
+
+    for (page = start; page < end; page += PGSIZE)
+    {
+        pte = s_page_lookup (page);
+        if (pte != NULL)
+            frame_unpin (pte);
+    }
+}
+
+/* If ENTRY's page holds nothing but zeros until it is written,
+   maps it read-only to the shared zero frame and returns true,
+   so that it takes up a frame of its own only once written (see
+   frame_unshare()).  Otherwise returns false. */
+bool
+s_page_map_zero(struct s_pte *entry)
+{
+    uint32_t *pd = thread_current ()->pagedir;
+
+    if (entry->frame != NULL
+        || !(entry->type == s_pte_type_STACK
+             || (entry->type == s_pte_type_FILE && entry->read_bytes == 0)))
+        return false;
+
+    return pagedir_get_page (pd, entry->upage) == NULL
+           && pagedir_set_page (pd, entry->upage, frame_zero (), false);
+}
+
 bool 
 load_segment_from_file(struct s_pte *entry)
 {
     bool page_install;
 
+    /* Read-only pages may already be in memory for another
+       process running the same program. */
+    if (!entry->writable && frame_share_text (entry) != NULL)
+        return true;
+
     /* Get a frame */
     void *frame = frame_allocate (entry->upage, PAL_USER);
     if (frame == NULL)
@@ -163,6 +458,9 @@ load_segment_from_file(struct s_pte *entry)
         frame_deallocate (frame, true);
         return false;
     }
+    if (!entry->writable)
+        frame_cache_text (entry);
+    frame_unpin (entry);
 
     return true;
 }
@@ -204,6 +502,7 @@ load_segment_from_mmap(struct s_pte *entry)
         frame_deallocate (frame, true);
         return false;
     }
+    frame_unpin (entry);
 
     return true;
 }
@@ -235,6 +534,7 @@ load_segment_from_swap(struct s_pte *entry)
         frame_deallocate (frame, true);
         return false;
     }
+    frame_unpin (entry);
 
     return true;
 }
@@ -249,9 +549,6 @@ load_segment_stack(struct s_pte *entry)
     frame = frame_allocate (entry->upage, PAL_USER | PAL_ZERO);
     if (frame == NULL)
         return false;
-    
-    /* set zero */
-    memset (frame, 0, PGSIZE);
 
     /* Load this page. */
     page_install = pagedir_get_page (thread_current()->pagedir, entry->upage) == NULL
@@ -261,6 +558,7 @@ load_segment_stack(struct s_pte *entry)
         frame_deallocate (frame, true);
         return false;
     }
+    frame_unpin (entry);
 
     return page_install;
 }
@@ -278,6 +576,8 @@ grow_stack(void* page)
         return NULL;
 
     pte->tid = t->tid;
+    pte->t = t;
+    pte->frame = NULL;
     pte->type = s_pte_type_STACK;
     pte->table_number = page;
     
@@ -33,10 +33,14 @@ struct s_pte {
 
     /* to load from mmap */
     int mmap_id;
-    struct list_elem mmap_elem;
 
     /* to load from swap-slot */
     size_t swap_slot;
+
+    /* while resident */
+    struct thread *t;           /* Owner, whose pagedir maps upage. */
+    struct fte *frame;          /* Frame holding the page, or NULL. */
+    struct list_elem frame_elem; /* Element in the frame's rmap. */
 };
 
 unsigned s_page_hash (const struct hash_elem *h, void *aux);
@@ -46,11 +50,26 @@ void s_page_delete(struct hash *target_table, struct hash_elem *he);
 
 void s_page_destroy (struct hash_elem *e, void *aux);
 void s_page_free(struct hash *target_table);
+bool s_page_fork(struct thread *parent);
 
 struct s_pte *s_page_lookup(void *kpage);
+struct s_pte *s_page_get(void *page);
 struct s_pte *grow_stack(void* page);
 struct s_pte *valid_address(void *addr);
 
+bool s_page_load(struct s_pte *entry);
+bool s_page_map_zero(struct s_pte *entry);
+bool s_page_pin(void *buffer, size_t size, bool write);
+void s_page_unpin(void *buffer, size_t size);
+void s_page_fault_around(struct s_pte *entry);
+
+/* Maximum size of the user stack. */
+#define STACK_MAX 0x0800000
+
+/* Most pages mapped ahead of a fault in a file-backed region.
+   Controlled by kernel command-line option "-fa=COUNT". */
+extern int fault_around_max;
+
 bool load_segment_from_file(struct s_pte *entry);
 bool load_segment_from_mmap(struct s_pte *entry);
 bool load_segment_from_swap(struct s_pte *entry);
@@ -1,164 +1,163 @@
 #include "vm/swap.h"
+#include <bitmap.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
-#include "threads/malloc.h"
-#include "userprog/syscall.h"
+#include "vm/zswap.h"
+
+/* Number of sectors in a swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Slots with this bit set are in the compressed tier (zswap.c)
+   rather than on the swap disk. */
+#define SWAP_ZSWAP 0x80000000u
+
+/* Pages of kernel pool set aside for the compressed tier, as a
+   fraction of the user pool. */
+#define ZSWAP_DIVISOR 8
+
+static struct block *swap_disk; // swap disk
+static struct bitmap *swap_table; // slots in use
+static struct lock swap_lock;
+
+/* Where the search for a free slot starts: just past the slot
+   handed out last, so allocation is O(1) amortized. */
+static size_t swap_hint;
+
+static void swap_read (uint32_t index, void *page);
 
 void
 swap_init (void)
 {
-    if(swap_table != NULL){
-        return;
-    }
-    struct ste *te;
-    size_t sectors_per_ste;
-    uint32_t entry_id, entry_number;
+    size_t slot_cnt;
+
+    lock_init (&swap_lock);
+    zswap_init (palloc_user_page_cnt () / ZSWAP_DIVISOR);
 
     /* init swap_disk */
-    swap_disk = block_get_role(BLOCK_SWAP);
-    if(swap_disk == NULL) 
+    swap_disk = block_get_role (BLOCK_SWAP);
+    if (swap_disk == NULL) 
     {
-        printf("swap_disk creation wrong\n");
-        sys_exit(-1, NULL);
+        printf ("No swap device, swapping to memory only\n");
+        return;
     } 
 
-    /* init swap_list */
-    sectors_per_ste = PGSIZE / BLOCK_SECTOR_SIZE;
-    entry_number = block_size(swap_disk) / sectors_per_ste;
-
-    swap_table = (struct list*)malloc(sizeof(struct list));
-    list_init (swap_table);
-    
-    for(entry_id = 0; entry_id < entry_number; entry_id++)
-    {
-        te = (struct ste*)malloc(sizeof(struct ste));
-        te->ste_id = entry_id;
-        te->is_free = true;
-
-        list_push_back (swap_table, &(te->elem));
-    }
-
-    /* init swap_lock */
-    lock_init(&swap_lock);
+    /* init swap_table */
+    slot_cnt = block_size (swap_disk) / SECTORS_PER_SLOT;
+    swap_table = bitmap_create (slot_cnt);
+    if (swap_table == NULL)
+        PANIC ("swap_init: can't allocate map of %zu slots", slot_cnt);
+    swap_hint = 0;
 
     return;
 }
 
+/* Releases swap slot INDEX without reading it. */
 void 
 swap_destroy (uint32_t index)
 {
-    struct list_elem *ste_elem;
-    struct ste *entry;
-
-    for(ste_elem = list_begin(swap_table); ste_elem != list_end(swap_table);
-        ste_elem = list_next (ste_elem))
+    if (index & SWAP_ZSWAP)
     {
-        entry = list_entry (ste_elem, struct ste, elem);
-        if(entry->ste_id == index)
-        {
-            entry->is_free = true;
-        }
-    }
-}
-
-void 
-swap_free (void)
-{
-    struct list_elem *ste_elem;
-    lock_acquire(&swap_lock);
-    /* free swap_disk */
-    free (swap_disk);
-    lock_release(&swap_lock);
-
-    /* free swap_table */
-    for(ste_elem = list_begin(swap_table); ste_elem != list_end(swap_table);
-        ste_elem = ste_elem)
-    {
-        ste_elem = list_remove(ste_elem);
+        zswap_free (index & ~SWAP_ZSWAP);
+        return;
     }
-    free (swap_table);
 
-    return;
+    lock_acquire (&swap_lock);
+    ASSERT (bitmap_test (swap_table, index));
+    bitmap_reset (swap_table, index);
+    lock_release (&swap_lock);
 }
 
-
+/* Reads swap slot INDEX into PAGE and releases the slot. */
 void 
 swap_in (uint32_t index, void *page)
 {
-  struct list_elem *ste_elem;
-  struct ste *entry;
-  uint32_t sector, count; 
-  void *addr;
-
-  /* find the ste */
-  for(ste_elem = list_begin(swap_table); ste_elem != list_end(swap_table);
-      ste_elem = list_next (ste_elem))
+  if (index & SWAP_ZSWAP)
   {
-      entry = list_entry (ste_elem, struct ste, elem);
-      if(entry->ste_id == index)
-      {
-        break;
-      }
+      zswap_load (index & ~SWAP_ZSWAP, page);
+      return;
   }
 
-  if(entry == NULL || entry->is_free == true)
+  swap_read (index, page);
+  swap_destroy (index);
+  return;
+}
+
+/* Reads swap slot INDEX into PAGE, keeping the slot. */
+static void
+swap_read (uint32_t index, void *page)
+{
+  if (index & SWAP_ZSWAP)
   {
-      printf("invalid index\n");
-      sys_exit(-1, NULL);
+      zswap_read (index & ~SWAP_ZSWAP, page);
+      return;
   }
 
-  lock_acquire(&swap_lock);
+  ASSERT (swap_table != NULL && index < bitmap_size (swap_table));
+  ASSERT (bitmap_test (swap_table, index));
+
   /* read from swap_disk */
-  for (count = 0; count < (PGSIZE / BLOCK_SECTOR_SIZE); count++) 
-  {
-      sector = index * (PGSIZE / BLOCK_SECTOR_SIZE) + count;
-      addr = page + (BLOCK_SECTOR_SIZE * count);
-      block_read (swap_disk, sector, addr);
-  }
+  block_read_multiple (swap_disk, index * SECTORS_PER_SLOT, page,
+                       SECTORS_PER_SLOT);
+}
+
+/* Copies swap slot INDEX to a new slot and returns it, or
+   BITMAP_ERROR if swap or kernel memory is full. */
+uint32_t
+swap_copy (uint32_t index)
+{
+  void *page;
+  uint32_t copy;
 
-  entry->is_free = true;
+  page = palloc_get_page (0);
+  if (page == NULL)
+      return BITMAP_ERROR;
 
-  lock_release(&swap_lock);
-  return;
+  swap_read (index, page);
+  copy = swap_out (page);
+  palloc_free_page (page);
+
+  return copy;
 }
 
+/* Writes PAGE to a free swap slot and returns the slot, or
+   BITMAP_ERROR if swap is full.  The page is compressed into
+   memory if it can be, and goes to the swap disk otherwise. */
 uint32_t 
 swap_out (void *page)
 {
-  //printf("in swap out\n");
-  struct list_elem *ste_elem;
-  struct ste *entry;
-  uint32_t sector, count; 
-  void *addr;
-  
-  /* find available sector */
-  for(ste_elem = list_begin(swap_table); ste_elem != list_end(swap_table);
-      ste_elem = list_next (ste_elem))
-  {
-      entry = list_entry (ste_elem, struct ste, elem);
-      if(entry->is_free == true)
-      {
-        break;
-      }
-  }
+  size_t index;
 
-  if(!entry->is_free)
+  index = zswap_store (page);
+  if (index != BITMAP_ERROR)
   {
-      printf("can't find free swap table entry\n");
-      return -1;
+      ASSERT (index < SWAP_ZSWAP);
+      return index | SWAP_ZSWAP;
   }
-
-  lock_acquire(&swap_lock);
-  /* write to swap_disk */
-  for (count = 0; count < (PGSIZE / BLOCK_SECTOR_SIZE); count++) 
+  
+  if (swap_table == NULL)
+      return BITMAP_ERROR;
+
+  /* find available slot */
+  lock_acquire (&swap_lock);
+  index = bitmap_scan_and_flip (swap_table, swap_hint, 1, false);
+  if (index == BITMAP_ERROR)
+      index = bitmap_scan_and_flip (swap_table, 0, 1, false);
+  if (index != BITMAP_ERROR)
+      swap_hint = index + 1;
+  lock_release (&swap_lock);
+
+  if (index == BITMAP_ERROR)
   {
-      sector = entry->ste_id * (PGSIZE / BLOCK_SECTOR_SIZE) + count;
-      addr = page + (BLOCK_SECTOR_SIZE * count);
-      //printf("origin addr: %#08X, sector: %d, addr: %#08X\n", page, sector, addr);
-      block_write (swap_disk, sector, addr);
+      printf ("can't find free swap table entry\n");
+      return BITMAP_ERROR;
   }
 
-  entry->is_free = false;
+  /* write to swap_disk */
+  block_write_multiple (swap_disk, index * SECTORS_PER_SLOT, page,
+                        SECTORS_PER_SLOT);
 
-  lock_release(&swap_lock);
-  return entry->ste_id;
-}
\ No newline at end of file
+  return index;
+}
@@ -0,0 +1,113 @@
+#include "vm/vma.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* A process's areas are kept in a list sorted by start address.
+   Processes have a handful of them, two or three ELF segments
+   and their memory mapped files, so a list is as fast as a tree
+   would be. */
+
+static bool vma_less (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux);
+
+/* Adds an area for pages START up to END to VMAS, backed by
+   READ_BYTES bytes of FILE starting at OFFSET and zeros after
+   them.  Returns the new area, or NULL if it would overlap
+   another or memory allocation fails. */
+struct vma *
+vma_create (struct list *vmas, void *start, void *end,
+            struct file *file, off_t offset, uint32_t read_bytes,
+            bool writable, int type)
+{
+    struct vma *vma;
+
+    ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+    ASSERT (start < end);
+    ASSERT (read_bytes <= (uint32_t) ((uint8_t *) end - (uint8_t *) start));
+
+    if (vma_overlaps (vmas, start, end))
+        return NULL;
+
+    vma = (struct vma *) malloc (sizeof(struct vma));
+    if (vma == NULL)
+        return NULL;
+
+    vma->start = start;
+    vma->end = end;
+    vma->file = file;
+    vma->offset = offset;
+    vma->read_bytes = read_bytes;
+    vma->writable = writable;
+    vma->type = type;
+    vma->mmap_id = -1;
+    list_insert_ordered (vmas, &vma->elem, vma_less, NULL);
+
+    return vma;
+}
+
+/* Returns the area in VMAS that contains ADDR, or NULL if there
+   is none. */
+struct vma *
+vma_find (struct list *vmas, const void *addr)
+{
+    struct list_elem *e;
+
+    for (e = list_begin (vmas); e != list_end (vmas); e = list_next (e))
+    {
+        struct vma *vma = list_entry (e, struct vma, elem);
+
+        if ((const uint8_t *) addr < vma->start)
+            break;
+        if ((const uint8_t *) addr < vma->end)
+            return vma;
+    }
+    return NULL;
+}
+
+/* Returns true if any area in VMAS has a page between START and
+   END. */
+bool
+vma_overlaps (struct list *vmas, const void *start, const void *end)
+{
+    struct list_elem *e;
+
+    for (e = list_begin (vmas); e != list_end (vmas); e = list_next (e))
+    {
+        struct vma *vma = list_entry (e, struct vma, elem);
+
+        if ((const uint8_t *) end <= vma->start)
+            break;
+        if ((const uint8_t *) start < vma->end)
+            return true;
+    }
+    return false;
+}
+
+/* Removes VMA from its list and frees it.  The caller must have
+   deleted the s_ptes of its pages. */
+void
+vma_destroy (struct vma *vma)
+{
+    list_remove (&vma->elem);
+    free (vma);
+}
+
+/* Frees every area in VMAS. */
+void
+vma_destroy_all (struct list *vmas)
+{
+    while (!list_empty (vmas))
+        vma_destroy (list_entry (list_front (vmas), struct vma, elem));
+}
+
+/* Orders areas by start address. */
+static bool
+vma_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED)
+{
+    const struct vma *a = list_entry (a_, struct vma, elem);
+    const struct vma *b = list_entry (b_, struct vma, elem);
+
+    return a->start < b->start;
+}
@@ -0,0 +1,34 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+/* A virtual memory area: a page-aligned range of a process's
+   address space backed by a file, an ELF segment or a memory
+   mapped file.  The s_pte for a page in the range is created
+   only when the page is first faulted in. */
+struct vma
+{
+    struct list_elem elem;      /* Element in thread's vma_list. */
+    uint8_t *start;             /* First page. */
+    uint8_t *end;               /* Just past the last page. */
+    struct file *file;          /* Backing file. */
+    off_t offset;               /* Offset in FILE of START. */
+    uint32_t read_bytes;        /* Bytes read from FILE, rest zero. */
+    bool writable;              /* Protection. */
+    int type;                   /* s_pte_type_FILE or _MMAP. */
+    int mmap_id;                /* Mapping id, if s_pte_type_MMAP. */
+};
+
+struct vma *vma_create (struct list *vmas, void *start, void *end,
+                        struct file *file, off_t offset,
+                        uint32_t read_bytes, bool writable, int type);
+struct vma *vma_find (struct list *vmas, const void *addr);
+bool vma_overlaps (struct list *vmas, const void *start, const void *end);
+void vma_destroy (struct vma *vma);
+void vma_destroy_all (struct list *vmas);
+
+#endif
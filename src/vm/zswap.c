@@ -0,0 +1,252 @@
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap tier.  Evicted pages are compressed into a
+   fixed region of kernel pool pages, so that bringing them back
+   costs a decompression instead of a disk read.  The region is
+   carved into ZSWAP_CHUNK-byte chunks; a stored page takes a run
+   of chunks that starts with its compressed length, and the
+   index of the first chunk names it.  Pages that don't compress
+   to ZSWAP_MAX_LEN bytes or less, or that don't fit, are left to
+   the swap disk. */
+#define ZSWAP_CHUNK 64
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+static uint8_t *zswap_pool;             /* Compressed pages. */
+static struct bitmap *zswap_chunks;     /* Chunks in use. */
+static size_t zswap_hint;               /* Next chunk to search from. */
+static struct lock zswap_lock;
+
+/* Compression codec: a byte-oriented LZ77 variant.  The output
+   is a sequence of items, each starting with a control byte C:
+
+   - C < 0x80: C + 1 literal bytes follow.
+
+   - C >= 0x80: copy (C & 0x7f) + LZ_MIN_MATCH bytes from the
+     output produced so far, starting OFFSET bytes back, where
+     OFFSET - 1 follows as two bytes, least significant first.
+
+   Matches are found through a hash table of the last position
+   at which each 3-byte sequence was seen. */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_HASH_BITS 10
+#define LZ_NO_POS 0xffff
+
+static uint16_t lz_hash[1 << LZ_HASH_BITS];
+static uint8_t zswap_buf[ZSWAP_MAX_LEN];
+
+static size_t lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max);
+static void lz_decompress (const uint8_t *src, size_t len, uint8_t *dst);
+
+/* Sets aside PAGE_CNT kernel pages for compressed swap.  If
+   PAGE_CNT is 0 or the pages aren't available, every page goes
+   to the swap disk. */
+void
+zswap_init (size_t page_cnt)
+{
+    lock_init (&zswap_lock);
+    if (page_cnt == 0)
+        return;
+
+    zswap_pool = palloc_get_multiple (0, page_cnt);
+    if (zswap_pool == NULL)
+        return;
+    zswap_chunks = bitmap_create (page_cnt * PGSIZE / ZSWAP_CHUNK);
+    if (zswap_chunks == NULL)
+    {
+        palloc_free_multiple (zswap_pool, page_cnt);
+        zswap_pool = NULL;
+        return;
+    }
+    zswap_hint = 0;
+}
+
+/* Compresses PAGE into the compressed tier and returns the index
+   it was stored under, or BITMAP_ERROR if it didn't compress well
+   or there is no room. */
+size_t
+zswap_store (const void *page)
+{
+    size_t len, chunk_cnt, index;
+
+    if (zswap_pool == NULL)
+        return BITMAP_ERROR;
+
+    lock_acquire (&zswap_lock);
+    len = lz_compress (page, zswap_buf, sizeof zswap_buf);
+    if (len == 0)
+    {
+        lock_release (&zswap_lock);
+        return BITMAP_ERROR;
+    }
+
+    chunk_cnt = DIV_ROUND_UP (sizeof (uint16_t) + len, ZSWAP_CHUNK);
+    index = bitmap_scan_and_flip (zswap_chunks, zswap_hint, chunk_cnt, false);
+    if (index == BITMAP_ERROR)
+        index = bitmap_scan_and_flip (zswap_chunks, 0, chunk_cnt, false);
+    if (index != BITMAP_ERROR)
+    {
+        uint8_t *p = zswap_pool + index * ZSWAP_CHUNK;
+
+        *(uint16_t *) p = len;
+        memcpy (p + sizeof (uint16_t), zswap_buf, len);
+        zswap_hint = index + chunk_cnt;
+    }
+    lock_release (&zswap_lock);
+
+    return index;
+}
+
+/* Decompresses the page stored under INDEX into PAGE and frees
+   it from the compressed tier. */
+void
+zswap_load (size_t index, void *page)
+{
+    zswap_read (index, page);
+    zswap_free (index);
+}
+
+/* Decompresses the page stored under INDEX into PAGE, leaving it
+   stored. */
+void
+zswap_read (size_t index, void *page)
+{
+    const uint8_t *p;
+
+    lock_acquire (&zswap_lock);
+    ASSERT (bitmap_test (zswap_chunks, index));
+    p = zswap_pool + index * ZSWAP_CHUNK;
+    lz_decompress (p + sizeof (uint16_t), *(const uint16_t *) p, page);
+    lock_release (&zswap_lock);
+}
+
+/* Frees the page stored under INDEX without reading it. */
+void
+zswap_free (size_t index)
+{
+    size_t len;
+
+    lock_acquire (&zswap_lock);
+    ASSERT (bitmap_test (zswap_chunks, index));
+    len = *(const uint16_t *) (zswap_pool + index * ZSWAP_CHUNK);
+    bitmap_set_multiple (zswap_chunks, index,
+                         DIV_ROUND_UP (sizeof (uint16_t) + len, ZSWAP_CHUNK),
+                         false);
+    lock_release (&zswap_lock);
+}
+
+/* Returns the lz_hash bucket for the 3 bytes at P. */
+static inline unsigned
+lz_hash_bytes (const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends the CNT literal bytes at SRC to DST, which holds *OUT
+   of at most DST_MAX bytes.  Returns false if they don't fit. */
+static bool
+lz_literals (const uint8_t *src, size_t cnt, uint8_t *dst, size_t *out,
+             size_t dst_max)
+{
+    while (cnt > 0)
+    {
+        size_t n = cnt < LZ_MAX_LITERALS ? cnt : LZ_MAX_LITERALS;
+
+        if (*out + 1 + n > dst_max)
+            return false;
+        dst[(*out)++] = n - 1;
+        memcpy (dst + *out, src, n);
+        *out += n;
+        src += n;
+        cnt -= n;
+    }
+    return true;
+}
+
+/* Compresses the page at SRC into DST.  Returns the compressed
+   length, or 0 if it would be longer than DST_MAX bytes.  Uses
+   lz_hash, so the caller must hold zswap_lock. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max)
+{
+    size_t in = 0, out = 0, lit = 0;
+
+    memset (lz_hash, 0xff, sizeof lz_hash);
+    while (in + LZ_MIN_MATCH <= PGSIZE)
+    {
+        unsigned h = lz_hash_bytes (src + in);
+        size_t cand = lz_hash[h];
+        size_t len, offset;
+
+        lz_hash[h] = in;
+        if (cand == LZ_NO_POS || memcmp (src + cand, src + in, LZ_MIN_MATCH))
+        {
+            in++;
+            continue;
+        }
+
+        len = LZ_MIN_MATCH;
+        while (in + len < PGSIZE && len < LZ_MAX_MATCH
+               && src[cand + len] == src[in + len])
+            len++;
+
+        if (!lz_literals (src + lit, in - lit, dst, &out, dst_max)
+            || out + 3 > dst_max)
+            return 0;
+        offset = in - cand - 1;
+        dst[out++] = 0x80 | (len - LZ_MIN_MATCH);
+        dst[out++] = offset & 0xff;
+        dst[out++] = offset >> 8;
+
+        in += len;
+        lit = in;
+    }
+
+    if (!lz_literals (src + lit, PGSIZE - lit, dst, &out, dst_max))
+        return 0;
+    return out;
+}
+
+/* Decompresses the LEN bytes at SRC into the page at DST. */
+static void
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t in = 0, out = 0;
+
+    while (in < len)
+    {
+        uint8_t c = src[in++];
+
+        if (c & 0x80)
+        {
+            size_t n = (c & 0x7f) + LZ_MIN_MATCH;
+            size_t offset = (src[in] | (src[in + 1] << 8)) + 1;
+
+            in += 2;
+            ASSERT (offset <= out && out + n <= PGSIZE);
+            for (; n > 0; n--, out++)
+                dst[out] = dst[out - offset];
+        }
+        else
+        {
+            size_t n = c + 1;
+
+            ASSERT (out + n <= PGSIZE);
+            memcpy (dst + out, src + in, n);
+            in += n;
+            out += n;
+        }
+    }
+    ASSERT (out == PGSIZE);
+}
@@ -0,0 +1,12 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stddef.h>
+
+void zswap_init (size_t page_cnt);
+size_t zswap_store (const void *page);
+void zswap_load (size_t index, void *page);
+void zswap_read (size_t index, void *page);
+void zswap_free (size_t index);
+
+#endif